@@ -33,7 +33,8 @@ layout( push_constant ) uniform constants
 
 void main() 
 {	
-	mat4 modelMatrix = objectBuffer.objects[gl_BaseInstance].model;
+	//gl_InstanceIndex already includes the draw's firstInstance, so instanced runs read consecutive objects
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
 	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
 	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
 	outColor = vColor;
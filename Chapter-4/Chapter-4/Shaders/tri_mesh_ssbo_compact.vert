@@ -0,0 +1,44 @@
+#version 460
+
+//CompactVertex: the snorm and unorm formats already unpack to floats
+layout (location = 0) in vec4 vPosition;
+layout (location = 1) in vec2 vNormal;
+layout (location = 2) in vec4 vColor;
+
+
+layout (location = 0) out vec3 outColor;
+
+
+layout(set = 0, binding = 0) uniform  CameraBuffer{   
+    mat4 view;
+    mat4 proj;
+	mat4 viewproj; 
+} cameraData;
+
+struct ObjectData{
+	mat4 model;
+}; 
+
+//all object matrices
+layout(std140,set = 1, binding = 0) readonly buffer ObjectBuffer{   
+
+	ObjectData objects[];
+} objectBuffer;
+
+//push constants block
+layout( push_constant ) uniform constants
+{
+ vec4 data;
+ mat4 render_matrix;
+} PushConstants;
+
+void main() 
+{	
+	//the engine folds the mesh's dequantization (bounds origin and scale) into the model matrix it writes for compact meshes,
+	//so the [-1,1] position goes straight through it
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
+	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
+	gl_Position = transformMatrix * vec4(vPosition.xyz, 1.0f);
+	outColor = vColor.rgb;
+	
+}
@@ -0,0 +1,175 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VK_CULL_AVX 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_CULL_SSE 1
+#endif
+
+//six world space planes (xyz normal pointing inside, w distance), in the order left, right, bottom, top, near, far
+struct Frustum {
+	glm::vec4	planes[6];
+};
+
+//extracts the frustum planes from a view-projection matrix (Gribb/Hartmann), for a 0..1 depth range
+inline Frustum extract_frustum(const glm::mat4& viewproj) {
+	//glm is column major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+	glm::vec4 row0 = glm::vec4(viewproj[0][0], viewproj[1][0], viewproj[2][0], viewproj[3][0]);
+	glm::vec4 row1 = glm::vec4(viewproj[0][1], viewproj[1][1], viewproj[2][1], viewproj[3][1]);
+	glm::vec4 row2 = glm::vec4(viewproj[0][2], viewproj[1][2], viewproj[2][2], viewproj[3][2]);
+	glm::vec4 row3 = glm::vec4(viewproj[0][3], viewproj[1][3], viewproj[2][3], viewproj[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row2;
+	frustum.planes[5] = row3 - row2;
+
+	//normalize so plane distances are in world units and comparable to sphere radii
+	for (int i = 0; i < 6; i++) {
+		glm::vec4& p = frustum.planes[i];
+		float len = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+		if (len > 0.0f) {
+			p /= len;
+		}
+	}
+	return frustum;
+}
+
+//world space bounding spheres in structure-of-arrays layout, so 4 or 8 of them can be tested with one instruction
+struct CullSpheres {
+	std::vector<float>	x;
+	std::vector<float>	y;
+	std::vector<float>	z;
+	std::vector<float>	radius;
+
+	void clear() {
+		x.clear();
+		y.clear();
+		z.clear();
+		radius.clear();
+	}
+
+	size_t size() const {
+		return x.size();
+	}
+
+	void push_back(const glm::vec3& center, float r) {
+		x.push_back(center.x);
+		y.push_back(center.y);
+		z.push_back(center.z);
+		radius.push_back(r);
+	}
+};
+
+//transforms a mesh space sphere by a model matrix, the radius is scaled by the largest axis scale
+inline void transform_sphere(const glm::mat4& model, const glm::vec3& origin, float radius, glm::vec3& outCenter, float& outRadius) {
+	glm::vec4 center = model * glm::vec4(origin, 1.0f);
+	outCenter = glm::vec3(center.x, center.y, center.z);
+
+	float sx = glm::dot(glm::vec3(model[0]), glm::vec3(model[0]));
+	float sy = glm::dot(glm::vec3(model[1]), glm::vec3(model[1]));
+	float sz = glm::dot(glm::vec3(model[2]), glm::vec3(model[2]));
+	outRadius = radius * sqrtf(glm::max(sx, glm::max(sy, sz)));
+}
+
+inline bool sphere_in_frustum(const Frustum& frustum, float x, float y, float z, float radius) {
+	for (int p = 0; p < 6; p++) {
+		const glm::vec4& plane = frustum.planes[p];
+		if (plane.x * x + plane.y * y + plane.z * z + plane.w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//appends the index of every sphere that intersects the frustum to outVisible, in increasing order
+inline void cull_spheres(const Frustum& frustum, const CullSpheres& spheres, std::vector<uint32_t>& outVisible) {
+	const uint32_t count = (uint32_t)spheres.size();
+	const float* xs = spheres.x.data();
+	const float* ys = spheres.y.data();
+	const float* zs = spheres.z.data();
+	const float* rs = spheres.radius.data();
+	uint32_t i = 0;
+
+#if defined(VK_CULL_AVX)
+	{
+		__m256 px[6], py[6], pz[6], pw[6];
+		for (int p = 0; p < 6; p++) {
+			px[p] = _mm256_set1_ps(frustum.planes[p].x);
+			py[p] = _mm256_set1_ps(frustum.planes[p].y);
+			pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+			pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+		}
+		const __m256 zero = _mm256_setzero_ps();
+		for (; i + 8 <= count; i += 8) {
+			__m256 x = _mm256_loadu_ps(xs + i);
+			__m256 y = _mm256_loadu_ps(ys + i);
+			__m256 z = _mm256_loadu_ps(zs + i);
+			__m256 negR = _mm256_sub_ps(zero, _mm256_loadu_ps(rs + i));
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++) {
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], x), _mm256_mul_ps(py[p], y)), _mm256_add_ps(_mm256_mul_ps(pz[p], z), pw[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(inside);
+			while (mask) {
+				int bit = 0;
+				while (!(mask & (1 << bit))) {
+					bit++;
+				}
+				outVisible.push_back(i + bit);
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+#if defined(VK_CULL_SSE)
+	{
+		__m128 px[6], py[6], pz[6], pw[6];
+		for (int p = 0; p < 6; p++) {
+			px[p] = _mm_set1_ps(frustum.planes[p].x);
+			py[p] = _mm_set1_ps(frustum.planes[p].y);
+			pz[p] = _mm_set1_ps(frustum.planes[p].z);
+			pw[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+		const __m128 zero = _mm_setzero_ps();
+		for (; i + 4 <= count; i += 4) {
+			__m128 x = _mm_loadu_ps(xs + i);
+			__m128 y = _mm_loadu_ps(ys + i);
+			__m128 z = _mm_loadu_ps(zs + i);
+			__m128 negR = _mm_sub_ps(zero, _mm_loadu_ps(rs + i));
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++) {
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y)), _mm_add_ps(_mm_mul_ps(pz[p], z), pw[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			if (mask & 1) outVisible.push_back(i + 0);
+			if (mask & 2) outVisible.push_back(i + 1);
+			if (mask & 4) outVisible.push_back(i + 2);
+			if (mask & 8) outVisible.push_back(i + 3);
+		}
+	}
+#endif
+	//scalar path for the tail, or everything when there is no simd
+	for (; i < count; i++) {
+		if (sphere_in_frustum(frustum, xs[i], ys[i], zs[i], rs[i])) {
+			outVisible.push_back(i);
+		}
+	}
+}
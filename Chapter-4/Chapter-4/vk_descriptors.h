@@ -0,0 +1,341 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include "vk_types.h"
+#include "vk_initializers.h"
+#include <algorithm>
+
+//Allocates descriptor sets from a growing list of pools.
+//When the current pool runs out a fresh one is grabbed, either a previously reset pool or a newly created one,
+//so callers never have to size pools up front. reset_pools() hands every pool back for reuse in one call.
+class DescriptorAllocator {
+public:
+	//descriptors of each type per pool, as a multiple of the pool's set count
+	struct PoolSizes {
+		std::vector<std::pair<VkDescriptorType, float>> sizes = {
+			{ VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 4.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 0.5f }
+		};
+	};
+
+	struct Stats {
+		uint64_t	setsAllocated;	//since the last reset
+		uint64_t	totalSetsAllocated;
+		uint32_t	poolsInUse;
+		uint32_t	freePools;
+		uint32_t	poolsCreated;
+	};
+
+	void init(VkDevice device, uint32_t setsPerPool = 1000, PoolSizes poolSizes = PoolSizes{}) {
+		_device = device;
+		_setsPerPool = setsPerPool;
+		_poolSizes = poolSizes;
+	}
+
+	void cleanup() {
+		for (VkDescriptorPool pool : _freePools) {
+			vkDestroyDescriptorPool(_device, pool, nullptr);
+		}
+		for (VkDescriptorPool pool : _usedPools) {
+			vkDestroyDescriptorPool(_device, pool, nullptr);
+		}
+		_freePools.clear();
+		_usedPools.clear();
+		_currentPool = VK_NULL_HANDLE;
+	}
+
+	//resets every pool this allocator handed sets out of. All of those sets become invalid.
+	void reset_pools() {
+		for (VkDescriptorPool pool : _usedPools) {
+			vkResetDescriptorPool(_device, pool, 0);
+			_freePools.push_back(pool);
+		}
+		_usedPools.clear();
+		_currentPool = VK_NULL_HANDLE;
+		_setsAllocated = 0;
+	}
+
+	bool allocate(VkDescriptorSet* set, VkDescriptorSetLayout layout) {
+		if (_currentPool == VK_NULL_HANDLE) {
+			_currentPool = grab_pool();
+			_usedPools.push_back(_currentPool);
+		}
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _currentPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &layout;
+
+		VkResult result = vkAllocateDescriptorSets(_device, &allocInfo, set);
+		if (result == VK_ERROR_FRAGMENTED_POOL || result == VK_ERROR_OUT_OF_POOL_MEMORY) {
+			//the current pool is full, move on to a new one and try once more
+			_currentPool = grab_pool();
+			_usedPools.push_back(_currentPool);
+			allocInfo.descriptorPool = _currentPool;
+			result = vkAllocateDescriptorSets(_device, &allocInfo, set);
+		}
+
+		if (result != VK_SUCCESS) {
+			//a fresh pool can't fit the set either, the layout needs more descriptors than PoolSizes provides
+			std::cout << "Descriptor set allocation failed: " << result << std::endl;
+			return false;
+		}
+		_setsAllocated++;
+		_totalSetsAllocated++;
+		return true;
+	}
+
+	Stats get_stats() const {
+		Stats stats;
+		stats.setsAllocated = _setsAllocated;
+		stats.totalSetsAllocated = _totalSetsAllocated;
+		stats.poolsInUse = (uint32_t)_usedPools.size();
+		stats.freePools = (uint32_t)_freePools.size();
+		stats.poolsCreated = _poolsCreated;
+		return stats;
+	}
+
+	VkDevice get_device() const {
+		return _device;
+	}
+private:
+	VkDescriptorPool grab_pool() {
+		if (!_freePools.empty()) {
+			VkDescriptorPool pool = _freePools.back();
+			_freePools.pop_back();
+			return pool;
+		}
+		return create_pool();
+	}
+
+	VkDescriptorPool create_pool() {
+		std::vector<VkDescriptorPoolSize> sizes;
+		sizes.reserve(_poolSizes.sizes.size());
+		for (auto& sz : _poolSizes.sizes) {
+			uint32_t count = (uint32_t)(sz.second * _setsPerPool);
+			if (count > 0) {
+				sizes.push_back({ sz.first, count });
+			}
+		}
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags = 0;
+		poolInfo.maxSets = _setsPerPool;
+		poolInfo.poolSizeCount = (uint32_t)sizes.size();
+		poolInfo.pPoolSizes = sizes.data();
+
+		VkDescriptorPool pool;
+		VK_CHECK(vkCreateDescriptorPool(_device, &poolInfo, nullptr, &pool));
+		_poolsCreated++;
+		return pool;
+	}
+
+	VkDevice						_device = VK_NULL_HANDLE;
+	uint32_t						_setsPerPool = 1000;
+	PoolSizes						_poolSizes;
+	VkDescriptorPool				_currentPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorPool>	_usedPools;
+	std::vector<VkDescriptorPool>	_freePools;
+	uint64_t						_setsAllocated = 0;
+	uint64_t						_totalSetsAllocated = 0;
+	uint32_t						_poolsCreated = 0;
+};
+
+//Deduplicates descriptor set layouts. Layouts are keyed by their binding array, so asking for the
+//same bindings twice returns the same VkDescriptorSetLayout, which also keeps pipeline layouts compatible.
+//The cache owns every layout it hands out.
+class DescriptorLayoutCache {
+public:
+	struct DescriptorLayoutInfo {
+		//sorted by binding number, immutable samplers are not part of the key
+		std::vector<VkDescriptorSetLayoutBinding>	bindings;
+		VkDescriptorSetLayoutCreateFlags			flags = 0;
+
+		bool operator==(const DescriptorLayoutInfo& other) const {
+			if (other.flags != flags || other.bindings.size() != bindings.size()) {
+				return false;
+			}
+			for (size_t i = 0; i < bindings.size(); i++) {
+				const VkDescriptorSetLayoutBinding& a = bindings[i];
+				const VkDescriptorSetLayoutBinding& b = other.bindings[i];
+				if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount || a.stageFlags != b.stageFlags) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		size_t hash() const {
+			size_t result = std::hash<size_t>()(bindings.size()) ^ std::hash<uint32_t>()(flags);
+			for (const VkDescriptorSetLayoutBinding& b : bindings) {
+				//pack the binding into one 64 bit value and mix it in
+				uint64_t packed = (uint64_t)b.binding | ((uint64_t)b.descriptorType << 8) | ((uint64_t)b.descriptorCount << 16) | ((uint64_t)b.stageFlags << 32);
+				result ^= std::hash<uint64_t>()(packed) + 0x9e3779b9 + (result << 6) + (result >> 2);
+			}
+			return result;
+		}
+	};
+
+	void init(VkDevice device) {
+		_device = device;
+	}
+
+	void cleanup() {
+		for (auto& entry : _layoutCache) {
+			vkDestroyDescriptorSetLayout(_device, entry.second, nullptr);
+		}
+		_layoutCache.clear();
+	}
+
+	VkDescriptorSetLayout create_descriptor_layout(const VkDescriptorSetLayoutCreateInfo* info) {
+		DescriptorLayoutInfo layoutInfo;
+		layoutInfo.flags = info->flags;
+		layoutInfo.bindings.assign(info->pBindings, info->pBindings + info->bindingCount);
+		std::sort(layoutInfo.bindings.begin(), layoutInfo.bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+			return a.binding < b.binding;
+			});
+
+		auto it = _layoutCache.find(layoutInfo);
+		if (it != _layoutCache.end()) {
+			return it->second;
+		}
+
+		VkDescriptorSetLayout layout;
+		VK_CHECK(vkCreateDescriptorSetLayout(_device, info, nullptr, &layout));
+		_layoutCache[layoutInfo] = layout;
+		return layout;
+	}
+
+	size_t layout_count() const {
+		return _layoutCache.size();
+	}
+private:
+	struct DescriptorLayoutHash {
+		size_t operator()(const DescriptorLayoutInfo& k) const {
+			return k.hash();
+		}
+	};
+
+	VkDevice	_device = VK_NULL_HANDLE;
+	std::unordered_map<DescriptorLayoutInfo, VkDescriptorSetLayout, DescriptorLayoutHash>	_layoutCache;
+};
+
+//Fluent helper that gets a layout from the cache, allocates a set and writes it in one go.
+//The buffer and image infos passed in must stay alive until build() is called.
+//With use_layout() the layout comes from shader reflection instead of the bind calls, which are then checked against it.
+class DescriptorBuilder {
+public:
+	static DescriptorBuilder begin(DescriptorLayoutCache* layoutCache, DescriptorAllocator* allocator) {
+		DescriptorBuilder builder;
+		builder._cache = layoutCache;
+		builder._alloc = allocator;
+		return builder;
+	}
+
+	DescriptorBuilder& bind_buffer(uint32_t binding, VkDescriptorBufferInfo* bufferInfo, VkDescriptorType type, VkShaderStageFlags stageFlags) {
+		_bindings.push_back(vkinit::descriptorset_layout_binding(type, stageFlags, binding));
+		_writes.push_back(vkinit::write_descriptor_buffer(type, VK_NULL_HANDLE, bufferInfo, binding));
+		return *this;
+	}
+
+	DescriptorBuilder& bind_image(uint32_t binding, VkDescriptorImageInfo* imageInfo, VkDescriptorType type, VkShaderStageFlags stageFlags) {
+		_bindings.push_back(vkinit::descriptorset_layout_binding(type, stageFlags, binding));
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstBinding = binding;
+		write.descriptorCount = 1;
+		write.descriptorType = type;
+		write.pImageInfo = imageInfo;
+		_writes.push_back(write);
+		return *this;
+	}
+
+	//takes the bindings the shaders declare as the layout. The bind calls still decide the descriptor type, so a buffer the
+	//shaders declare plain can be bound dynamic, but their stage flags are replaced by the stages that actually use the binding.
+	//an empty list (reflection failed) keeps the bindings as written
+	DescriptorBuilder& use_layout(const std::vector<VkDescriptorSetLayoutBinding>& shaderBindings) {
+		_shaderBindings = shaderBindings;
+		return *this;
+	}
+
+	bool build(VkDescriptorSet& set, VkDescriptorSetLayout& layout) {
+		if (!_shaderBindings.empty()) {
+			apply_shader_layout();
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.pBindings = _bindings.data();
+		layoutInfo.bindingCount = (uint32_t)_bindings.size();
+
+		layout = _cache->create_descriptor_layout(&layoutInfo);
+
+		if (!_alloc->allocate(&set, layout)) {
+			return false;
+		}
+
+		for (VkWriteDescriptorSet& write : _writes) {
+			write.dstSet = set;
+		}
+		vkUpdateDescriptorSets(_alloc->get_device(), (uint32_t)_writes.size(), _writes.data(), 0, nullptr);
+		return true;
+	}
+
+	bool build(VkDescriptorSet& set) {
+		VkDescriptorSetLayout layout;
+		return build(set, layout);
+	}
+private:
+	static bool compatible_types(VkDescriptorType declared, VkDescriptorType written) {
+		return declared == written
+			|| (declared == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER && written == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+			|| (declared == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER && written == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+	}
+
+	//replaces the written bindings with the declared ones, reporting every place the two disagree instead of leaving it to validation
+	void apply_shader_layout() {
+		std::vector<VkDescriptorSetLayoutBinding> bindings = _shaderBindings;
+		for (const VkDescriptorSetLayoutBinding& written : _bindings) {
+			auto it = std::find_if(bindings.begin(), bindings.end(), [&](const VkDescriptorSetLayoutBinding& b) {
+				return b.binding == written.binding;
+				});
+			if (it == bindings.end()) {
+				std::cout << "Descriptor binding " << written.binding << " is written but no shader declares it" << std::endl;
+				bindings.push_back(written);
+				continue;
+			}
+			if (!compatible_types(it->descriptorType, written.descriptorType)) {
+				std::cout << "Descriptor binding " << written.binding << " is declared as type " << it->descriptorType << " but written as type " << written.descriptorType << std::endl;
+			}
+			it->descriptorType = written.descriptorType;
+		}
+
+		for (const VkDescriptorSetLayoutBinding& declared : _shaderBindings) {
+			auto it = std::find_if(_bindings.begin(), _bindings.end(), [&](const VkDescriptorSetLayoutBinding& b) {
+				return b.binding == declared.binding;
+				});
+			if (it == _bindings.end()) {
+				std::cout << "Descriptor binding " << declared.binding << " is declared by the shaders but never written" << std::endl;
+			}
+		}
+		_bindings = bindings;
+	}
+
+	std::vector<VkWriteDescriptorSet>			_writes;
+	std::vector<VkDescriptorSetLayoutBinding>	_bindings;
+	std::vector<VkDescriptorSetLayoutBinding>	_shaderBindings;
+
+	DescriptorLayoutCache*	_cache = nullptr;
+	DescriptorAllocator*	_alloc = nullptr;
+};
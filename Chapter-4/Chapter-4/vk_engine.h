@@ -4,81 +4,19 @@
 #include "vk_types.h"
 #include "vk_initializers.h"
 #include "vk_mesh.h"
+#include "vk_jobs.h"
+#include "vk_descriptors.h"
+#include "vk_culling.h"
+#include "vk_sort.h"
+#include "vk_pipelines.h"
+#include "vk_filewatch.h"
+#include "vk_shaders.h"
+#include "vk_upload.h"
+#include "vk_suballoc.h"
 #include "VkBootstrap.h"
 
-//we want to immediately abort when there is an error. In normal engines this would give an error message to the user, or perform a dump of state.
 using namespace std;
-#define VK_CHECK(x)                                                 \
-	do                                                              \
-	{                                                               \
-		VkResult err = x;                                           \
-		if (err)                                                    \
-		{                                                           \
-			std::cout <<"Detected Vulkan error: " << err << std::endl; \
-			abort();                                                \
-		}                                                           \
-	} while (0)
-
-
-struct PipelineBuilder {
-	std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
-	VkPipelineVertexInputStateCreateInfo _vertexInputInfo;
-	VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
-	VkViewport _viewport;
-	VkRect2D _scissor;
-	VkPipelineRasterizationStateCreateInfo _rasterizer;
-	VkPipelineColorBlendAttachmentState _colorBlendAttachment;
-	VkPipelineMultisampleStateCreateInfo _multiSampling;
-	VkPipelineLayout _pipelineLayout;
-	VkPipelineDepthStencilStateCreateInfo _depthStencil;
-
-	VkPipeline build_pipeline(VkDevice device, VkRenderPass renderPass) {
-		//make viewport state from our stored viewport and scissor.
-		//at the moment we won't support multiple viewports and scissors
-		VkPipelineViewportStateCreateInfo viewportState{};
-		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewportState.viewportCount = 1;
-		viewportState.pViewports = &_viewport;
-		viewportState.scissorCount = 1;
-		viewportState.pScissors = &_scissor;
-
-		//Setup dummy color blending. We aren't using transparent objects yet.
-		//The blending is just "no blend", but we do write to the color attachment.
-		VkPipelineColorBlendStateCreateInfo colorBlending{};
-		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-
-		colorBlending.logicOpEnable = VK_FALSE;
-		colorBlending.logicOp = VK_LOGIC_OP_COPY;
-		colorBlending.attachmentCount = 1;
-		colorBlending.pAttachments = &_colorBlendAttachment;
-
-		//Build the actual pipeline.
-		//We now use all of the info structs we have been writing into this one to create the pipeline.
-		VkGraphicsPipelineCreateInfo pipelineInfo{};
-		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineInfo.stageCount = static_cast<uint32_t> (_shaderStages.size());
-		pipelineInfo.pStages = _shaderStages.data();
-		pipelineInfo.pVertexInputState = &_vertexInputInfo;
-		pipelineInfo.pInputAssemblyState = &_inputAssembly;
-		pipelineInfo.pViewportState = &viewportState;
-		pipelineInfo.pRasterizationState = &_rasterizer;
-		pipelineInfo.pMultisampleState = &_multiSampling;
-		pipelineInfo.pColorBlendState = &colorBlending;
-		pipelineInfo.layout = _pipelineLayout;
-		pipelineInfo.pDepthStencilState = &_depthStencil;
-		pipelineInfo.renderPass = renderPass;
-		pipelineInfo.subpass = 0;
-		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-
-		//It's easy to error out on create graphics pipeline, so we handle it a bit better than the common VK_CHECK case.
-		VkPipeline newPipeline = VK_NULL_HANDLE;
-		if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
-			std::cout << "failed to create pipeline" << std::endl;
-			return VK_NULL_HANDLE;
-		}
-		return newPipeline;
-	}
-};
+
 
 struct DeletionQueue {
 	std::deque < std::function<void()>> deletors;
@@ -95,6 +33,49 @@ struct DeletionQueue {
 	}
 };
 
+//a sub-allocation from a FrameAllocator
+struct FrameAllocation {
+	void*		data;	//cpu pointer into the mapped buffer
+	uint32_t	offset;	//byte offset in the buffer, used as the dynamic descriptor offset
+};
+
+//linear allocator over one persistently mapped buffer for data that only lives for a single frame.
+//it is reset once the frame's fence has signaled, so there is no per-allocation bookkeeping or freeing.
+struct FrameAllocator {
+	AllocatedBuffer	_buffer;
+	char*			_mapped = nullptr;
+	size_t			_capacity = 0;
+	size_t			_head = 0;
+
+	FrameAllocation allocate(size_t size, size_t alignment) {
+		size_t offset = _head;
+		if (alignment > 1) {
+			offset = (offset + alignment - 1) & ~(alignment - 1);
+		}
+		if (offset + size > _capacity) {
+			std::cout << "Frame allocator out of memory, " << size << " bytes requested with " << _capacity - _head << " left" << std::endl;
+			abort();
+		}
+		_head = offset + size;
+
+		FrameAllocation allocation;
+		allocation.data = _mapped + offset;
+		allocation.offset = (uint32_t)offset;
+		return allocation;
+	}
+
+	//flushes everything handed out this frame, a no-op on coherent memory
+	void flush(VmaAllocator allocator) {
+		if (_head > 0) {
+			vmaFlushAllocation(allocator, _buffer._allocation, 0, _head);
+		}
+	}
+
+	void reset() {
+		_head = 0;
+	}
+};
+
 struct MeshPushConstants {
 	glm::vec4	data;
 	glm::mat4	render_matrix;
@@ -103,6 +84,9 @@ struct MeshPushConstants {
 struct Material {
 	VkPipeline			pipeline;
 	VkPipelineLayout	pipelineLayout;
+	uint32_t			pipelineId;	//small ids for the draw sort key, assigned by create_material
+	uint32_t			materialId;
+	bool				backFaceCulled = false;	//the pipeline culls back faces, so clusters facing away can be dropped before they're drawn
 };
 
 struct RenderObject {
@@ -115,6 +99,45 @@ struct GPUObjectData {
 	glm::mat4		modelMatrix;
 };
 
+//per object input to the culling compute shader, matches CullObject in indirect_cull.comp (std430)
+struct GPUCullObject {
+	glm::vec4	sphere;			//mesh space bounds, w is the radius
+	uint32_t	indexCount;
+	uint32_t	firstIndex;
+	int32_t		vertexOffset;
+	uint32_t	runIndex;		//also the index of the run's indirect command
+	uint32_t	instanceBase;	//first slot of the run in the visible object buffer
+	uint32_t	pad[3];
+};
+
+struct GPUCullConstants {
+	glm::vec4	planes[6];
+	uint32_t	objectCount;
+};
+
+//consecutive sorted objects that share a mesh and material, drawn as one instanced command
+struct DrawRun {
+	Mesh*		mesh;
+	Material*	material;
+	uint32_t	lod;	//level of detail every object of the run is drawn with
+	uint32_t	first;	//first object of the run in sorted order
+	uint32_t	count;
+	uint32_t	firstRange;	//visible meshlet ranges in _drawRanges, a cluster culled run is one object drawn as rangeCount pieces
+	uint32_t	rangeCount;	//0 draws the whole level
+};
+
+//a piece of a mesh's index list left after cluster culling, consecutive visible meshlets are merged into one
+struct DrawRange {
+	uint32_t	firstIndex;	//relative to the mesh's first index
+	uint32_t	indexCount;
+};
+
+struct GPUCameraData {
+	glm::mat4	view;
+	glm::mat4	proj;
+	glm::mat4	viewproj;
+};
+
 struct FrameData {
 	VkSemaphore	_presentSemaphore;
 	VkSemaphore _renderSemaphore;
@@ -125,17 +148,27 @@ struct FrameData {
 	VkCommandPool	_commandPool;
 	VkCommandBuffer	_mainCommandBuffer;
 
-	AllocatedBuffer	_cameraBuffer;
-	VkDescriptorSet	_globalDescriptor;
+	//one pool and secondary command buffer per recording chunk, so worker threads never share a pool
+	std::vector<VkCommandPool>		_recordCommandPools;
+	std::vector<VkCommandBuffer>	_recordCommandBuffers;
+
+	//camera, scene and object data for this frame are all sub-allocated from here
+	FrameAllocator	_frameAllocator;
 
-	AllocatedBuffer	_objectBuffer;
+	VkDescriptorSet	_globalDescriptor;
 	VkDescriptorSet	_objectDescriptor;
+
+	//written by the culling compute shader, read by the indirect draws
+	AllocatedBuffer	_indirectBuffer;		//one instanced command per draw run
+	AllocatedBuffer	_visibleObjectBuffer;	//matrices of the objects that passed culling
+	VkDescriptorSet	_cullDescriptor;
+	VkDescriptorSet	_visibleObjectDescriptor;	//same layout as _objectDescriptor, over _visibleObjectBuffer
 };
 
-struct GPUCameraData {
-	glm::mat4	view;
-	glm::mat4	proj;
-	glm::mat4	viewproj;
+struct UploadContext {
+	VkFence			_uploadFence;
+	VkCommandPool	_commandPool;
+	VkCommandBuffer	_commandBuffer;
 };
 
 struct GPUSceneData {
@@ -147,6 +180,52 @@ struct GPUSceneData {
 };
 
 constexpr unsigned int FRAME_OVERLAP = 2;
+constexpr uint32_t MAX_OBJECTS = 10000;
+//per-frame transient memory, big enough for the object array plus all the uniform data
+constexpr size_t FRAME_ALLOCATOR_SIZE = 4 * 1024 * 1024;
+
+//size of the shared mesh buffers. The vertex buffer is counted in bytes since meshes of both vertex formats live in it, the index buffer in indices
+constexpr uint32_t MESH_VERTEX_BUFFER_SIZE = (1 << 20) * sizeof(Vertex);
+constexpr uint32_t MESH_INDEX_CAPACITY = 1 << 22;
+//view depth mapped onto the sort key's depth bucket, matches the camera far plane
+constexpr float DRAW_SORT_DEPTH_RANGE = 200.0f;
+//the low bits of the sort key's mesh field hold the level of detail, so a mesh's objects group by level before depth
+constexpr uint32_t DRAW_SORT_LOD_BITS = 3;
+//meshes with fewer meshlets than this are drawn whole, the extra draws would cost more than the triangles they save
+constexpr uint32_t CLUSTER_CULL_MIN_MESHLETS = 8;
+//below this many objects to draw a frame is recorded inline, the jobs would cost more than they save
+constexpr size_t PARALLEL_RECORD_MIN_OBJECTS = 512;
+//driver pipeline cache, loaded at init and written back at cleanup
+constexpr const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+//the programs whose reflected interface defines the engine's descriptor set and pipeline layouts
+constexpr const char* MESH_VERTEX_SHADER_PATH = "Shaders/tri_mesh_ssbo.vert.spv";
+constexpr const char* MESH_FRAGMENT_SHADER_PATH = "Shaders/default_lit.frag.spv";
+//vertex shader of the material variants that read CompactVertex, same interface as the mesh vertex shader
+constexpr const char* MESH_COMPACT_VERTEX_SHADER_PATH = "Shaders/tri_mesh_ssbo_compact.vert.spv";
+//appended to a material's name for its CompactVertex variant
+constexpr const char* COMPACT_MATERIAL_SUFFIX = "_compact";
+constexpr const char* CULL_SHADER_PATH = "Shaders/indirect_cull.comp.spv";
+
+//everything needed to build a material's pipeline. Kept after the build so the pipeline can be rebuilt when one of its shaders changes
+struct MaterialBuildRequest {
+	std::string		name;
+	PipelineBuilder	builder;	//fixed function state and layout, the shader stages and vertex input are filled in from the fields below
+	std::vector<std::pair<VkShaderStageFlagBits, std::string>>	shaders;	//stage and .spv path
+	VertexInputDescription	vertexDescription;
+};
+
+//a destroy that has to wait until every frame that might still use the object has finished
+struct DeferredDeletion {
+	int						frame;	//frame number it was queued on
+	std::function<void()>	function;
+};
+
+struct MeshLoadRequest {
+	std::string	name;
+	std::string	path;	//obj file, the binary cache next to it is used when up to date
+	VertexFormat	format = VertexFormat::Full;	//compact meshes are quantized after loading, if the compact materials could be built
+};
 
 class VulkanEngine {
 	GLFWwindow*					_window;
@@ -159,6 +238,8 @@ class VulkanEngine {
 	FrameData					_frames[FRAME_OVERLAP];
 	VkQueue						_graphicsQueue;
 	uint32_t					_graphicsQueueFamily;
+	VkQueue						_transferQueue;		//dedicated transfer queue if the device has one, graphics queue otherwise
+	uint32_t					_transferQueueFamily;
 	VkSwapchainKHR				_swapchain;
 	VkFormat					_swapchainImageFormat;
 	std::vector<VkImage>		_swapchainImages;
@@ -167,7 +248,8 @@ class VulkanEngine {
 	std::vector<VkFramebuffer>	_framebuffers;
 	//VkCommandPool				_commandPool;
 	//VkCommandBuffer				_mainCommandBuffer;
-	VkDescriptorPool			_descriptorPool;
+	DescriptorAllocator			_descriptorAllocator;	//long lived sets
+	DescriptorLayoutCache		_descriptorLayoutCache;
 	VkDescriptorSetLayout		_globalSetLayout;
 	VkDescriptorSetLayout		_objectSetLayout;
 	/*VkFence						_renderFence;
@@ -187,12 +269,76 @@ class VulkanEngine {
 
 	VmaAllocator				_allocator;
 
+	VkPipelineCache				_pipelineCache = VK_NULL_HANDLE;
+	PipelineStateCache			_pipelineStateCache;	//deduplicates graphics pipelines by their full state
+
+	//shader modules and their reflection, and the recipe of every material so it can be rebuilt when a shader is reloaded
+	ShaderCache					_shaderCache;
+	ShaderReflection			_meshProgram;	//merged interface of the mesh shaders, empty if they couldn't be read
+	ShaderReflection			_cullProgram;
+	std::unordered_map<std::string, MaterialBuildRequest>	_materialRecipes;
+	FileWatcher					_shaderWatcher;
+	std::deque<DeferredDeletion>	_deferredDeletions;
+
+	JobSystem					_jobSystem;
+	AsyncUploader				_uploader;
+
+	//meshes parsed by the job system that are waiting for their gpu upload
+	std::mutex					_streamMutex;
+	std::vector<std::pair<std::string, Mesh>>	_streamedMeshes;
+
 	std::vector<RenderObject>	_renderables;
+
+	//frustum culling scratch, kept around so the per-frame vectors don't reallocate
+	bool						_enableFrustumCulling = true;
+	CullSpheres					_cullSpheres;
+	//cluster culling splits big meshes drawn at full detail into their visible meshlets, on the cpu culling path (G switches to it).
+	//cone culling also drops clusters facing away from the camera. It's always on for materials that cull back faces,
+	//the C key forces it for the rest too, which is only right for closed meshes since those pipelines would draw the back faces
+	bool						_enableClusterCulling = true;
+	bool						_enableClusterConeCulling = false;
+	std::vector<DrawRange>		_drawRanges;
+	std::vector<uint32_t>		_visibleObjects;
+
+	//draw sort, objects are drawn in key order so equal state ends up adjacent and same-mesh runs become one instanced draw
+	std::vector<SortItem>		_sortItems;
+	std::vector<SortItem>		_sortScratch;
+	std::unordered_map<VkPipeline, uint32_t>	_pipelineSortIds;
+	std::unordered_map<const Mesh*, uint32_t>	_meshSortIds;
+
+	//levels of detail are picked per object so their error covers at most this many pixels on screen, 0 always draws the full mesh
+	float						_lodErrorThreshold = 1.0f;
+	float						_lodProjectionScale = 0.0f;	//pixels per unit of size at a view depth of 1
+
+	//gpu culling, used instead of the cpu path when the compute shader and device features are available
+	bool						_enableGpuCulling = true;
+	bool						_gpuCullingSupported = false;
+	bool						_multiDrawIndirect = false;
+	VkPipeline					_cullPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout			_cullPipelineLayout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout		_cullSetLayout;
+	std::vector<DrawRun>		_drawRuns;
+
+	//state handed from prepare_draws to draw_objects
+	uint32_t					_drawGlobalOffsets[2];
+	uint32_t					_drawObjectOffset;
+	bool						_drawGpuCulled = false;
+	//set once more objects than MAX_OBJECTS were drawn, so the warning isn't repeated every frame
+	bool						_objectLimitWarned = false;
+
+	//draw runs are split into this many chunks, each recorded by a job into its own secondary command buffer
+	uint32_t					_recordChunkCount = 1;
 	std::unordered_map<std::string, Material>	_materials;
 	std::unordered_map<std::string, Mesh>		_meshes;
 
+	//every mesh's vertices and indices live in these two buffers, each mesh owns a range handed out by the range allocators.
+	//draws address their mesh with vertexOffset and firstIndex, so the buffers are bound once per command buffer
+	AllocatedBuffer				_meshVertexBuffer;
+	AllocatedBuffer				_meshIndexBuffer;
+	RangeAllocator				_meshVertexRanges;
+	RangeAllocator				_meshIndexRanges;
+
 	GPUSceneData				_sceneParameters;
-	AllocatedBuffer				_sceneParameterBuffer;
 
 
 
@@ -203,6 +349,8 @@ class VulkanEngine {
 	//the format for the depth image
 	VkFormat					_depthFormat;
 
+	UploadContext				_uploadContext;
+
 	int							_selectedShader = 0;
 
 	bool						_isInitialized = false;
@@ -215,10 +363,217 @@ class VulkanEngine {
 		Material mat;
 		mat.pipeline = pipeline;
 		mat.pipelineLayout = layout;
+
+		//materials sharing a pipeline share its id, so they sort next to each other
+		auto pipelineIt = _pipelineSortIds.find(pipeline);
+		if (pipelineIt == _pipelineSortIds.end()) {
+			pipelineIt = _pipelineSortIds.emplace(pipeline, (uint32_t)_pipelineSortIds.size()).first;
+		}
+		mat.pipelineId = pipelineIt->second;
+
+		auto existing = _materials.find(name);
+		mat.materialId = existing != _materials.end() ? existing->second.materialId : (uint32_t)_materials.size();
+
 		_materials[name] = mat;
 		return &_materials[name];
 	}
 
+	//compiles the pipelines of every request in parallel and only then registers the materials,
+	//so no half built material is ever visible. Requests whose pipeline failed are skipped
+	void create_materials(std::vector<MaterialBuildRequest>& requests) {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		//requests whose shaders failed to load are dropped before the batch, builtRequests maps each builder back to its request.
+		//every module is acquired once per builder and released after the batch, pipelines don't need them once created
+		std::vector<PipelineBuilder> builders;
+		std::vector<size_t> builtRequests;
+		std::vector<ShaderCache::Module> modules;
+		builders.reserve(requests.size());
+		for (size_t i = 0; i < requests.size(); i++) {
+			PipelineBuilder builder;
+			if (!make_material_builder(requests[i], builder, modules)) {
+				std::cout << "Missing shaders for material " << requests[i].name << std::endl;
+				continue;
+			}
+			builders.push_back(builder);
+			builtRequests.push_back(i);
+		}
+
+		std::vector<VkPipeline> pipelines;
+		_pipelineStateCache.get_pipelines(builders, _renderPass, _jobSystem, pipelines);
+		release_shaders(modules);
+
+		for (size_t i = 0; i < builtRequests.size(); i++) {
+			MaterialBuildRequest& request = requests[builtRequests[i]];
+			if (pipelines[i] == VK_NULL_HANDLE) {
+				std::cout << "Failed to build the pipeline for material " << request.name << std::endl;
+				continue;
+			}
+			Material* material = create_material(pipelines[i], request.builder._pipelineLayout, request.name);
+			material->backFaceCulled = (request.builder._rasterizer.cullMode & VK_CULL_MODE_BACK_BIT) != 0;
+			_materialRecipes[request.name] = request;
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Built " << requests.size() << " material pipelines in " << seconds * 1000.0 << " ms on " << _jobSystem.worker_count() << " threads" << std::endl;
+	}
+
+	//fills in the shader stages and vertex input of the request's builder, false if one of its shaders can't be loaded.
+	//the modules it acquires are appended to modules for the caller to release after the build.
+	//the builder points into request, so it must outlive the build
+	bool make_material_builder(MaterialBuildRequest& request, PipelineBuilder& builder, std::vector<ShaderCache::Module>& modules) {
+		builder = request.builder;
+		builder._shaderStages.clear();
+		builder._shaderHashes.clear();
+		for (auto& shader : request.shaders) {
+			ShaderCache::Module module = acquire_shader(shader.second);
+			if (module.module == VK_NULL_HANDLE) {
+				return false;
+			}
+			modules.push_back(module);
+			builder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(shader.first, module.module));
+			builder._shaderHashes.push_back(module.hash);
+		}
+
+		builder._vertexInputInfo.pVertexAttributeDescriptions = request.vertexDescription.attributes.data();
+		builder._vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(request.vertexDescription.attributes.size());
+
+		builder._vertexInputInfo.pVertexBindingDescriptions = request.vertexDescription.bindings.data();
+		builder._vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(request.vertexDescription.bindings.size());
+		return true;
+	}
+
+	//a module for a .spv file from the shader cache, watching the file for changes from the first time it's asked for
+	ShaderCache::Module acquire_shader(const std::string& path) {
+		_shaderWatcher.watch(path);
+		return _shaderCache.acquire(path);
+	}
+
+	void release_shaders(std::vector<ShaderCache::Module>& modules) {
+		for (const ShaderCache::Module& module : modules) {
+			_shaderCache.release(module);
+		}
+		modules.clear();
+	}
+
+	//merges the reflected interface of every stage of a program, false if a stage can't be read or two stages disagree
+	bool reflect_program(const std::vector<std::string>& paths, ShaderReflection& program) {
+		for (const std::string& path : paths) {
+			_shaderWatcher.watch(path);
+			const ShaderCache::ShaderInfo* info = _shaderCache.get_info(path);
+			if (info == nullptr || !program.merge(info->reflection)) {
+				program = ShaderReflection{};
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//picks up .spv files that changed on disk, rebuilds the pipelines of every material that uses them and swaps them in.
+	//the replaced pipelines are destroyed once the frames that may still be using them have finished
+	void reload_changed_shaders() {
+		std::vector<std::string> changed;
+		_shaderWatcher.poll(changed);
+		if (changed.empty()) {
+			return;
+		}
+
+		std::vector<std::string> reloaded;
+		for (const std::string& path : changed) {
+			ShaderCache::ShaderInfo info;
+			if (!_shaderCache.read_info(path, info)) {
+				std::cout << "Failed to reload " << path << ", keeping the old shader" << std::endl;
+				continue;
+			}
+			const ShaderCache::ShaderInfo* current = _shaderCache.get_info(path);
+			//saved without changes, or rewritten by a build that produced the same code
+			if (current && current->hash == info.hash && current->wordCount == info.wordCount) {
+				continue;
+			}
+			//descriptor set and pipeline layouts were made from the old interface and aren't rebuilt
+			if (current && !info.reflection.same_interface(current->reflection)) {
+				std::cout << path << " changed its bindings or push constants, restart to pick it up" << std::endl;
+				continue;
+			}
+			_shaderCache.set_info(path, info);
+			reloaded.push_back(path);
+		}
+		if (reloaded.empty()) {
+			return;
+		}
+
+		std::vector<MaterialBuildRequest*> affected;
+		for (auto& entry : _materialRecipes) {
+			for (auto& shader : entry.second.shaders) {
+				if (std::find(reloaded.begin(), reloaded.end(), shader.second) != reloaded.end()) {
+					affected.push_back(&entry.second);
+					break;
+				}
+			}
+		}
+
+		//a recipe whose shaders can't be loaded any more keeps its pipeline, its builder is left without stages and skipped
+		std::vector<PipelineBuilder> builders;
+		std::vector<MaterialBuildRequest*> rebuilt;
+		std::vector<ShaderCache::Module> modules;
+		for (MaterialBuildRequest* recipe : affected) {
+			PipelineBuilder builder;
+			if (!make_material_builder(*recipe, builder, modules)) {
+				std::cout << "Failed to rebuild material " << recipe->name << ", keeping the old pipeline" << std::endl;
+				continue;
+			}
+			builders.push_back(builder);
+			rebuilt.push_back(recipe);
+		}
+		std::vector<VkPipeline> pipelines;
+		_pipelineStateCache.get_pipelines(builders, _renderPass, _jobSystem, pipelines);
+		release_shaders(modules);
+
+		std::vector<VkPipeline> retired;
+		for (size_t i = 0; i < rebuilt.size(); i++) {
+			if (pipelines[i] == VK_NULL_HANDLE) {
+				std::cout << "Failed to rebuild material " << rebuilt[i]->name << ", keeping the old pipeline" << std::endl;
+				continue;
+			}
+
+			Material& material = _materials[rebuilt[i]->name];
+			VkPipeline oldPipeline = material.pipeline;
+			material.pipeline = pipelines[i];
+
+			//materials that shared the old pipeline share the new one, so it inherits the sort id too
+			auto sortIt = _pipelineSortIds.find(oldPipeline);
+			if (sortIt != _pipelineSortIds.end()) {
+				_pipelineSortIds[pipelines[i]] = sortIt->second;
+			}
+
+			if (oldPipeline != pipelines[i] && std::find(retired.begin(), retired.end(), oldPipeline) == retired.end()) {
+				retired.push_back(oldPipeline);
+			}
+		}
+
+		for (VkPipeline pipeline : retired) {
+			_pipelineStateCache.remove(pipeline);
+			_pipelineSortIds.erase(pipeline);
+			defer_deletion([=]() {
+				vkDestroyPipeline(_device, pipeline, nullptr);
+				});
+		}
+
+		std::cout << "Reloaded " << reloaded.size() << " shaders, rebuilt " << rebuilt.size() << " materials" << std::endl;
+	}
+
+	void defer_deletion(std::function<void()>&& function) {
+		_deferredDeletions.push_back({ _frameNumber, std::move(function) });
+	}
+
+	//runs the deferred deletions whose frames are all finished, or every one of them when the device is idle
+	void flush_deferred_deletions(bool all) {
+		while (!_deferredDeletions.empty() && (all || _deferredDeletions.front().frame + (int)FRAME_OVERLAP <= _frameNumber)) {
+			_deferredDeletions.front().function();
+			_deferredDeletions.pop_front();
+		}
+	}
+
 	Material* get_material(const std::string& name) {
 		//search for object, and return nullptr if not found
 		auto it = _materials.find(name);
@@ -228,6 +583,14 @@ class VulkanEngine {
 		return &(*it).second;
 	}
 
+	//the variant of a material that reads the mesh's vertex format
+	Material* get_material(const std::string& name, const Mesh* mesh) {
+		if (mesh != nullptr && mesh->_format == VertexFormat::Compact) {
+			return get_material(name + COMPACT_MATERIAL_SUFFIX);
+		}
+		return get_material(name);
+	}
+
 	Mesh* get_mesh(const std::string& name) {
 		auto it = _meshes.find(name);
 		if (it == _meshes.end()) {
@@ -236,7 +599,76 @@ class VulkanEngine {
 		return &(*it).second;
 	}
 
-	void draw_objects(VkCommandBuffer cmd, RenderObject* first, int count) {
+	//meshes get their sort id the first time they are drawn
+	uint32_t get_mesh_sort_id(const Mesh* mesh) {
+		auto it = _meshSortIds.find(mesh);
+		if (it == _meshSortIds.end()) {
+			it = _meshSortIds.emplace(mesh, (uint32_t)_meshSortIds.size()).first;
+		}
+		return it->second;
+	}
+
+	//the coarsest level of detail whose error projects to no more than _lodErrorThreshold pixels at the object's view depth
+	uint32_t select_lod(const RenderObject& object, float depth) const {
+		const Mesh* mesh = object.mesh;
+		uint32_t levels = glm::min(mesh->lod_count(), 1u << DRAW_SORT_LOD_BITS);
+		if (levels == 1 || depth <= 0.0f || _lodErrorThreshold <= 0.0f) {
+			return 0;
+		}
+		//errors are in mesh units, scaled by the largest axis of the object's transform
+		const glm::mat4& m = object.tranformMatrix;
+		float scale = sqrtf(glm::max(glm::dot(glm::vec3(m[0]), glm::vec3(m[0])), glm::max(glm::dot(glm::vec3(m[1]), glm::vec3(m[1])), glm::dot(glm::vec3(m[2]), glm::vec3(m[2])))));
+		float pixelsPerUnit = scale * _lodProjectionScale / depth;
+		for (uint32_t level = levels - 1; level > 0; level--) {
+			if (mesh->get_lod(level).error * pixelsPerUnit <= _lodErrorThreshold) {
+				return level;
+			}
+		}
+		return 0;
+	}
+
+	static uint32_t get_sort_key_lod(uint64_t key) {
+		return (uint32_t)(key >> 16) & ((1u << DRAW_SORT_LOD_BITS) - 1);
+	}
+
+	//builds a sort key for each listed object (every object when indices is null) and sorts them into _sortItems
+	void sort_objects(RenderObject* first, const uint32_t* indices, size_t count, const glm::mat4& viewproj) {
+		_sortItems.clear();
+
+		const Mesh* lastMesh = nullptr;
+		uint32_t meshId = 0;
+		for (size_t i = 0; i < count; i++) {
+			uint32_t objectIndex = indices ? indices[i] : (uint32_t)i;
+			const RenderObject& object = first[objectIndex];
+
+			//a mesh that didn't fit in the shared buffers, or is still streaming in, has nothing to draw
+			if (!object.mesh->_resident) {
+				continue;
+			}
+
+			if (object.mesh != lastMesh) {
+				meshId = get_mesh_sort_id(object.mesh);
+				lastMesh = object.mesh;
+			}
+
+			//clip space w of the bounds center is its view depth with a perspective projection
+			glm::vec4 center = object.tranformMatrix * glm::vec4(object.mesh->_bounds.origin, 1.0f);
+			float depth = viewproj[0][3] * center.x + viewproj[1][3] * center.y + viewproj[2][3] * center.z + viewproj[3][3];
+			uint32_t depthBucket = (uint32_t)(glm::clamp(depth / DRAW_SORT_DEPTH_RANGE, 0.0f, 1.0f) * 65535.0f);
+			uint32_t lod = select_lod(object, depth);
+
+			SortItem item;
+			item.key = make_sort_key(object.material->pipelineId, object.material->materialId, (meshId << DRAW_SORT_LOD_BITS) | lod, depthBucket);
+			item.index = objectIndex;
+			_sortItems.push_back(item);
+		}
+
+		radix_sort(_sortItems, _sortScratch);
+	}
+
+	//writes this frame's uniform and object data and culls the objects, either on the cpu or with a compute dispatch.
+	//it records commands for the gpu path, so it has to run outside the render pass, before draw_objects()
+	void prepare_draws(VkCommandBuffer cmd, RenderObject* first, int count) {
 		auto& frame = get_current_frame();
 		//make a model view matrix for rendering the object
 		//camera view
@@ -246,92 +678,345 @@ class VulkanEngine {
 		//camera projection
 		glm::mat4 projection = glm::perspective(glm::radians(70.0f), 1700.0f / 900.0f, 0.1f, 200.0f);
 		projection[1][1] *= -1;
+		_lodProjectionScale = fabsf(projection[1][1]) * _windowExtent.height * 0.5f;
 
 		GPUCameraData camData;
 		camData.proj = projection;
 		camData.view = view;
 		camData.viewproj = projection * view;
 
-		void* data;
-		vmaMapMemory(_allocator, frame._cameraBuffer._allocation, &data);
-		memcpy(data, &camData, sizeof(GPUCameraData));
-		vmaUnmapMemory(_allocator, frame._cameraBuffer._allocation);
+		//all per-frame data comes from the frame allocator, the descriptors only need new dynamic offsets
+		FrameAllocation cameraAlloc = frame._frameAllocator.allocate(sizeof(GPUCameraData), _gpuProperties.limits.minUniformBufferOffsetAlignment);
+		*(GPUCameraData*)cameraAlloc.data = camData;
 
 		float framed = (_frameNumber / 120.0f);
 
 		_sceneParameters.ambientColor = { sin(framed),0,cos(framed),1 };
 
-		char* sceneData;
-		vmaMapMemory(_allocator, _sceneParameterBuffer._allocation, (void**)&sceneData);
-		int frameIndex = _frameNumber % FRAME_OVERLAP;
-		sceneData += pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameIndex;
-		memcpy(sceneData, &_sceneParameters, sizeof(GPUSceneData));
-		vmaUnmapMemory(_allocator, _sceneParameterBuffer._allocation);
+		FrameAllocation sceneAlloc = frame._frameAllocator.allocate(sizeof(GPUSceneData), _gpuProperties.limits.minUniformBufferOffsetAlignment);
+		*(GPUSceneData*)sceneAlloc.data = _sceneParameters;
 
-		void* objectData;
-		vmaMapMemory(_allocator, frame._objectBuffer._allocation, &objectData);
-		GPUObjectData* objectSSBO = (GPUObjectData*)objectData;
+		//the object descriptor covers MAX_OBJECTS entries, so the whole range has to be reserved
+		FrameAllocation objectAlloc = frame._frameAllocator.allocate(sizeof(GPUObjectData) * MAX_OBJECTS, _gpuProperties.limits.minStorageBufferOffsetAlignment);
+		GPUObjectData* objectSSBO = (GPUObjectData*)objectAlloc.data;
 
+		//dynamic offsets are consumed in binding order
+		_drawGlobalOffsets[0] = cameraAlloc.offset;
+		_drawGlobalOffsets[1] = sceneAlloc.offset;
+		_drawObjectOffset = objectAlloc.offset;
+
+		Frustum frustum = extract_frustum(camData.viewproj);
+
+		_drawGpuCulled = _enableGpuCulling && _enableFrustumCulling && _gpuCullingSupported;
+		if (_drawGpuCulled) {
+			prepare_gpu_culling(cmd, frustum, camData.viewproj, objectSSBO, objectAlloc.offset, first, count);
+			return;
+		}
+
+		//cull every object's bounding sphere against the camera frustum, only the visible ones get written and drawn
+		_cullSpheres.clear();
+		_visibleObjects.clear();
 		for (int i = 0; i < count; i++) {
-			RenderObject& object = first[i];
-			objectSSBO[i].modelMatrix = object.tranformMatrix;
+			const RenderObject& object = first[i];
+			glm::vec3 center;
+			float radius;
+			transform_sphere(object.tranformMatrix, object.mesh->_bounds.origin, object.mesh->_bounds.radius, center, radius);
+			_cullSpheres.push_back(center, radius);
+		}
+		if (_enableFrustumCulling) {
+			cull_spheres(frustum, _cullSpheres, _visibleObjects);
+		}
+		else {
+			for (int i = 0; i < count; i++) {
+				_visibleObjects.push_back(i);
+			}
+		}
+
+		if (_visibleObjects.size() > MAX_OBJECTS) {
+			warn_object_limit(_visibleObjects.size());
+			_visibleObjects.resize(MAX_OBJECTS);
 		}
 
-		vmaUnmapMemory(_allocator, frame._objectBuffer._allocation);
+		sort_objects(first, _visibleObjects.data(), _visibleObjects.size(), camData.viewproj);
 
-		Mesh* lastMesh = nullptr;
-		Material* lastMaterial = nullptr;
+		//the camera is wherever the view matrix maps to the origin
+		glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+
+		//object data is packed in sorted order, so a run of instances reads consecutive matrices
+		_drawRuns.clear();
+		_drawRanges.clear();
+		for (size_t i = 0; i < _sortItems.size(); i++) {
+			const RenderObject& object = first[_sortItems[i].index];
+			objectSSBO[i].modelMatrix = get_gpu_model_matrix(object);
+			uint32_t lod = get_sort_key_lod(_sortItems[i].key);
+			if (_enableClusterCulling && lod == 0 && object.mesh->_meshlets.size() >= CLUSTER_CULL_MIN_MESHLETS) {
+				add_cluster_culled_run(object, (uint32_t)i, frustum, cameraPosition);
+			}
+			else {
+				add_to_draw_runs(object, lod, (uint32_t)i);
+			}
+		}
+
+		frame._frameAllocator.flush(_allocator);
+	}
+
+	//objects past MAX_OBJECTS don't fit the per frame buffers and aren't drawn
+	void warn_object_limit(size_t count) {
+		if (!_objectLimitWarned) {
+			std::cout << "Drawing " << count << " objects, only the first " << MAX_OBJECTS << " fit and the rest are skipped" << std::endl;
+			_objectLimitWarned = true;
+		}
+	}
+
+	//the matrix the vertex shader gets for an object. Compact meshes store positions relative to their bounds,
+	//mapping them back into mesh space here means the compact shader needs nothing per mesh
+	static glm::mat4 get_gpu_model_matrix(const RenderObject& object) {
+		if (object.mesh->_format == VertexFormat::Compact) {
+			return object.tranformMatrix * object.mesh->get_dequantize_matrix();
+		}
+		return object.tranformMatrix;
+	}
+
+	//culls the object's meshlets and adds a run of its own drawing the visible ones, nothing at all if every cluster was culled
+	void add_cluster_culled_run(const RenderObject& object, uint32_t index, const Frustum& frustum, const glm::vec3& cameraPosition) {
+		const Mesh* mesh = object.mesh;
+		glm::vec3 localCamera = glm::vec3(glm::inverse(object.tranformMatrix) * glm::vec4(cameraPosition, 1.0f));
+
+		DrawRun run;
+		run.mesh = object.mesh;
+		run.material = object.material;
+		run.lod = 0;
+		run.first = index;
+		run.count = 1;
+		run.firstRange = (uint32_t)_drawRanges.size();
+		run.rangeCount = 0;
+		const bool coneCulling = _enableClusterConeCulling || object.material->backFaceCulled;
+		for (const Meshlet& meshlet : mesh->_meshlets) {
+			if (cull_meshlet(meshlet, object.tranformMatrix, localCamera, frustum, coneCulling)) {
+				continue;
+			}
+			//meshlets are consecutive in the index list, so one that follows the last visible one extends its range
+			if (run.rangeCount > 0 && _drawRanges.back().firstIndex + _drawRanges.back().indexCount == meshlet.firstIndex) {
+				_drawRanges.back().indexCount += meshlet.indexCount;
+				continue;
+			}
+			_drawRanges.push_back(DrawRange{ meshlet.firstIndex, meshlet.indexCount });
+			run.rangeCount++;
+		}
+		if (run.rangeCount > 0) {
+			_drawRuns.push_back(run);
+		}
+	}
+
+	//appends the object at sorted position index to the last run, or starts a new one when its mesh, level of detail or material differ. Returns the run index
+	uint32_t add_to_draw_runs(const RenderObject& object, uint32_t lod, uint32_t index) {
+		if (_drawRuns.empty() || _drawRuns.back().mesh != object.mesh || _drawRuns.back().lod != lod || _drawRuns.back().material != object.material
+			|| _drawRuns.back().rangeCount > 0) {
+			DrawRun run;
+			run.mesh = object.mesh;
+			run.material = object.material;
+			run.lod = lod;
+			run.first = index;
+			run.count = 0;
+			run.firstRange = 0;
+			run.rangeCount = 0;
+			_drawRuns.push_back(run);
+		}
+		_drawRuns.back().count++;
+		return (uint32_t)_drawRuns.size() - 1;
+	}
+
+	//writes every object in sorted order plus its culling input, and records the culling dispatch.
+	//the cpu only copies data and splits the objects into runs, the per object decision and draw command are made on the gpu
+	void prepare_gpu_culling(VkCommandBuffer cmd, const Frustum& frustum, const glm::mat4& viewproj, GPUObjectData* objectSSBO, uint32_t objectOffset, RenderObject* first, int count) {
+		auto& frame = get_current_frame();
+		if (count > (int)MAX_OBJECTS) {
+			warn_object_limit(count);
+			count = MAX_OBJECTS;
+		}
+
+		FrameAllocation cullAlloc = frame._frameAllocator.allocate(sizeof(GPUCullObject) * MAX_OBJECTS, _gpuProperties.limits.minStorageBufferOffsetAlignment);
+		GPUCullObject* cullSSBO = (GPUCullObject*)cullAlloc.data;
+
+		//sorting every object keeps the number of runs, and so indirect calls, down to the number of distinct mesh/material pairs
+		sort_objects(first, nullptr, count, viewproj);
+		count = (int)_sortItems.size();
+
+		_drawRuns.clear();
 		for (int i = 0; i < count; i++) {
-			RenderObject& object = first[i];
+			RenderObject& object = first[_sortItems[i].index];
+			objectSSBO[i].modelMatrix = get_gpu_model_matrix(object);
+			uint32_t lod = get_sort_key_lod(_sortItems[i].key);
+			uint32_t runIndex = add_to_draw_runs(object, lod, (uint32_t)i);
+
+			GPUCullObject& cullObject = cullSSBO[i];
+			//the cull shader transforms the sphere by the matrix above, so it has to be in the space of the stored vertices
+			cullObject.sphere = object.mesh->get_vertex_sphere();
+			MeshLod meshLod = object.mesh->get_lod(lod);
+			cullObject.indexCount = meshLod.indexCount;
+			cullObject.firstIndex = object.mesh->_firstIndex + meshLod.firstIndex;
+			cullObject.vertexOffset = (int32_t)object.mesh->_vertexOffset;
+			cullObject.runIndex = runIndex;
+			cullObject.instanceBase = _drawRuns[runIndex].first;
+		}
+
+		frame._frameAllocator.flush(_allocator);
+
+		if (count == 0) {
+			return;
+		}
+
+		//instance counts are accumulated with atomics, so every run's command starts out zeroed
+		vkCmdFillBuffer(cmd, frame._indirectBuffer._buffer, 0, sizeof(VkDrawIndexedIndirectCommand) * _drawRuns.size(), 0);
+
+		VkBufferMemoryBarrier clearBarrier = vkinit::buffer_barrier(frame._indirectBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &clearBarrier, 0, nullptr);
+
+		GPUCullConstants constants;
+		for (int i = 0; i < 6; i++) {
+			constants.planes[i] = frustum.planes[i];
+		}
+		constants.objectCount = (uint32_t)count;
+
+		uint32_t cullOffsets[] = { objectOffset, cullAlloc.offset };
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &frame._cullDescriptor, 2, cullOffsets);
+		vkCmdPushConstants(cmd, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullConstants), &constants);
+		vkCmdDispatch(cmd, (count + 255) / 256, 1, 1);
+
+		//the commands have to land before the indirect draws read them, and the matrices before the vertex shader does
+		VkBufferMemoryBarrier commandBarrier = vkinit::buffer_barrier(frame._indirectBuffer._buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+		VkBufferMemoryBarrier objectBarrier = vkinit::buffer_barrier(frame._visibleObjectBuffer._buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, 1, &commandBarrier, 0, nullptr);
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 1, &objectBarrier, 0, nullptr);
+	}
+
+	//objects in the draw runs, sorted positions [0, count) are what draw_objects takes
+	size_t draw_object_count() const {
+		return _drawRuns.empty() ? 0 : _drawRuns.back().first + _drawRuns.back().count;
+	}
+
+	//records the objects at sorted positions [objectBegin, objectEnd) into cmd, which can be the primary or one of the secondary command buffers.
+	//every run is one instanced draw, indirect when the gpu culled the objects. A run crossing either end is cut down to its objects inside,
+	//except an indirect one, whose instance count is only known on the gpu, which is drawn whole by the range holding its first object
+	void draw_objects(VkCommandBuffer cmd, size_t objectBegin, size_t objectEnd) {
+		auto& frame = get_current_frame();
+		const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+		//with gpu culling the vertex shader reads the compacted visible matrices, which always start at offset 0
+		VkDescriptorSet objectDescriptor = _drawGpuCulled ? frame._visibleObjectDescriptor : frame._objectDescriptor;
+		const uint32_t objectOffset = _drawGpuCulled ? 0 : _drawObjectOffset;
+
+		//every mesh is a range of the shared buffers, so they're bound once for the whole command buffer
+		VkDeviceSize vertexBufferOffset = 0;
+		vkCmdBindVertexBuffers(cmd, 0, 1, &_meshVertexBuffer._buffer, &vertexBufferOffset);
+		vkCmdBindIndexBuffer(cmd, _meshIndexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+
+		//runs are in sorted order, so the first one ending past objectBegin is where the range starts
+		size_t r = std::upper_bound(_drawRuns.begin(), _drawRuns.end(), objectBegin, [](size_t object, const DrawRun& run) {
+			return object < run.first + run.count;
+			}) - _drawRuns.begin();
+		if (_drawGpuCulled && r < _drawRuns.size() && _drawRuns[r].first < objectBegin) {
+			r++;
+		}
+
+		Material* lastMaterial = nullptr;
+		VkPipeline lastPipeline = VK_NULL_HANDLE;
+		for (; r < _drawRuns.size() && _drawRuns[r].first < objectEnd; r++) {
+			const DrawRun& run = _drawRuns[r];
 
 			//only bind the pipeline if it doesn't match with the one already bound
-			if (object.material != lastMaterial) {
-				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
-				lastMaterial = object.material;
+			if (run.material->pipeline != lastPipeline) {
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, run.material->pipeline);
+				lastPipeline = run.material->pipeline;
+			}
+
+			if (run.material != lastMaterial) {
+				lastMaterial = run.material;
 
-				uint32_t uniform_offset = (uint32_t)pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameIndex;
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 0, 1, &frame._globalDescriptor, 1, &uniform_offset);
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, run.material->pipelineLayout, 0, 1, &frame._globalDescriptor, 2, _drawGlobalOffsets);
 
 				//object data descriptor
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 1, 1, &frame._objectDescriptor, 0, nullptr);
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, run.material->pipelineLayout, 1, 1, &objectDescriptor, 1, &objectOffset);
+			}
+
+			//instance n of the run reads object first + n through gl_InstanceIndex
+			if (_drawGpuCulled) {
+				//runs of the same material only differ in their commands now that no mesh needs its own buffers,
+				//so with multiDrawIndirect they go out as one call
+				size_t batchEnd = r + 1;
+				if (_multiDrawIndirect) {
+					while (batchEnd < _drawRuns.size() && _drawRuns[batchEnd].first < objectEnd && _drawRuns[batchEnd].material == run.material && batchEnd - r < _gpuProperties.limits.maxDrawIndirectCount) {
+						batchEnd++;
+					}
+				}
+				vkCmdDrawIndexedIndirect(cmd, frame._indirectBuffer._buffer, (VkDeviceSize)r * stride, (uint32_t)(batchEnd - r), stride);
+				r = batchEnd - 1;
 			}
+			else if (run.rangeCount > 0) {
+				//the visible pieces of a cluster culled object, all reading the same object data
+				for (uint32_t i = 0; i < run.rangeCount; i++) {
+					const DrawRange& range = _drawRanges[run.firstRange + i];
+					vkCmdDrawIndexed(cmd, range.indexCount, 1, run.mesh->_firstIndex + range.firstIndex, (int32_t)run.mesh->_vertexOffset, run.first);
+				}
+			}
+			else {
+				uint32_t firstInstance = std::max(run.first, (uint32_t)objectBegin);
+				uint32_t lastInstance = std::min(run.first + run.count, (uint32_t)objectEnd);
+				MeshLod lod = run.mesh->get_lod(run.lod);
+				vkCmdDrawIndexed(cmd, lod.indexCount, lastInstance - firstInstance, run.mesh->_firstIndex + lod.firstIndex, (int32_t)run.mesh->_vertexOffset, firstInstance);
+			}
+		}
+	}
 
-			glm::mat4 model = object.tranformMatrix;
-			//final render matrix, that we are calculating on the cpu
-			glm::mat4 mesh_matrix = model;
+	//splits the sorted objects into even chunks and records each one into a secondary command buffer on the job system,
+	//then executes them in order from the primary. A big instanced run is shared between the chunks it spans.
+	//The render pass has to be begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	void draw_objects_parallel(VkCommandBuffer cmd, VkFramebuffer framebuffer) {
+		auto& frame = get_current_frame();
+		const size_t objectCount = draw_object_count();
+		const uint32_t chunkCount = _recordChunkCount;
 
-			MeshPushConstants constants;
-			constants.render_matrix = mesh_matrix;
+		VkCommandBufferInheritanceInfo inheritanceInfo = vkinit::command_buffer_inheritance_info(_renderPass, 0, framebuffer);
 
-			//updload the mesh to the gpu via pushconstants
-			vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+		_jobSystem.parallel_for(chunkCount, [&](uint32_t chunk) {
+			VkCommandBuffer secondary = frame._recordCommandBuffers[chunk];
 
-			//only bind the mesh if it's a different on from the last bind
-			if (object.mesh != lastMesh) {
-				//bind the mesh vertex buffer with offset 0
-				VkDeviceSize offset = 0;
-				vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->_vertexBuffer._buffer, &offset);
-				lastMesh = object.mesh;
-			}
+			VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
+			VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
 
-			//we can now draw
-			vkCmdDraw(cmd, (uint32_t)object.mesh->_vertices.size(), 1, 0, i);
-		}
+			//secondaries inherit no bound state, so each chunk binds its own pipeline, descriptors and buffers
+			draw_objects(secondary, objectCount * chunk / chunkCount, objectCount * (chunk + 1) / chunkCount);
+
+			VK_CHECK(vkEndCommandBuffer(secondary));
+			});
+
+		vkCmdExecuteCommands(cmd, chunkCount, frame._recordCommandBuffers.data());
 	}
 
 	void init_scene() {
 		RenderObject monkey;
 		monkey.mesh = get_mesh("monkey");
-		monkey.material = get_material("defaultMesh");
+		monkey.material = get_material("defaultMesh", monkey.mesh);
 		monkey.tranformMatrix = glm::translate(glm::mat4{ 1.0f },glm::vec3(0,1,0));
 
 		_renderables.push_back(monkey);
 
+		//full precision monkeys behind the grid, drawn once their streamed mesh has been uploaded
+		for (int x = -8; x <= 8; x += 4) {
+			RenderObject fullMonkey;
+			fullMonkey.mesh = get_mesh("monkey_full");
+			fullMonkey.material = get_material("defaultMesh", fullMonkey.mesh);
+			fullMonkey.tranformMatrix = glm::translate(glm::mat4{ 1.0f }, glm::vec3(x, 1, -15));
+			_renderables.push_back(fullMonkey);
+		}
+
 		for (int x = -20; x <= 20; x++) {
 			for (int y = -20; y <= 20; y++) {
 				RenderObject tri;
 				tri.mesh = get_mesh("triangle");
-				tri.material = get_material("defaultMesh");
+				tri.material = get_material("defaultMesh", tri.mesh);
 				glm::mat4 translation = glm::translate(glm::mat4{ 1.0 }, glm::vec3(x, 0, y));
 				glm::mat4 scale = glm::scale(glm::mat4{ 1.0 }, glm::vec3(0.2, 0.2, 0.2));
 				tri.tranformMatrix = translation * scale;
@@ -349,6 +1034,17 @@ class VulkanEngine {
 	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
 		auto app = reinterpret_cast<VulkanEngine*>(glfwGetWindowUserPointer(window));
+		//G switches between gpu and cpu culling, only the cpu path culls meshlets. C forces meshlet cone culling on every material
+		if (action == GLFW_PRESS && key == GLFW_KEY_G) {
+			app->_enableGpuCulling = !app->_enableGpuCulling;
+			std::cout << (app->_enableGpuCulling && app->_gpuCullingSupported ? "GPU" : "CPU") << " culling" << std::endl;
+			return;
+		}
+		if (action == GLFW_PRESS && key == GLFW_KEY_C) {
+			app->_enableClusterConeCulling = !app->_enableClusterConeCulling;
+			std::cout << "Meshlet cone culling " << (app->_enableClusterConeCulling ? "forced on" : "only for back face culled materials") << std::endl;
+			return;
+		}
 		if (action == GLFW_PRESS)
 			
 			app->_selectedShader = (++app->_selectedShader) % 2;
@@ -385,6 +1081,16 @@ class VulkanEngine {
 			.select()
 			.value();
 
+		//indirect draws carry each run's first instance in firstInstance.
+		//enable it if the gpu has it, gpu culling falls back to the cpu path without it
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedFeatures);
+		physicalDevice.features.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		_gpuCullingSupported = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+		//lets the gpu culled runs of one material go out in a single indirect call
+		physicalDevice.features.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		_multiDrawIndirect = supportedFeatures.multiDrawIndirect == VK_TRUE;
+
 		//create the final vulkan device
 		vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 
@@ -398,6 +1104,16 @@ class VulkanEngine {
 
 		_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+		//prefer a transfer-only queue family for streaming, so copies run next to rendering instead of in front of it
+		auto transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+		if (transferQueue.has_value()) {
+			_transferQueue = transferQueue.value();
+			_transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+		}
+		else {
+			_transferQueue = _graphicsQueue;
+			_transferQueueFamily = _graphicsQueueFamily;
+		}
 
 		//initalize the memory allocator
 		VmaAllocatorCreateInfo allocatorInfo{};
@@ -413,6 +1129,13 @@ class VulkanEngine {
 			vmaDestroyAllocator(_allocator);
 			});
 
+		_uploader.init(_device, _allocator, _transferQueue, _transferQueueFamily, _graphicsQueueFamily);
+
+		_mainDeletionQueue.push_function([=]() {
+			_uploader.cleanup();
+			});
+
+		std::cout << "Streaming uploads use " << (_uploader.uses_dedicated_queue() ? "a dedicated transfer queue" : "the graphics queue") << std::endl;
 
 		vkGetPhysicalDeviceProperties(_chosenGPU, &_gpuProperties);
 
@@ -585,6 +1308,38 @@ class VulkanEngine {
 				vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
 				});
 		}
+
+		//secondary command buffers for parallel recording, one chunk per worker thread.
+		//the pools are transient and reset as a whole at the start of each frame
+		_recordChunkCount = std::max(1u, _jobSystem.worker_count());
+		VkCommandPoolCreateInfo recordPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+		for (int i = 0; i < FRAME_OVERLAP; i++) {
+			_frames[i]._recordCommandPools.resize(_recordChunkCount);
+			_frames[i]._recordCommandBuffers.resize(_recordChunkCount);
+
+			for (uint32_t c = 0; c < _recordChunkCount; c++) {
+				VK_CHECK(vkCreateCommandPool(_device, &recordPoolInfo, nullptr, &_frames[i]._recordCommandPools[c]));
+
+				VkCommandBufferAllocateInfo secondaryAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._recordCommandPools[c], 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+				VK_CHECK(vkAllocateCommandBuffers(_device, &secondaryAllocInfo, &_frames[i]._recordCommandBuffers[c]));
+
+				_mainDeletionQueue.push_function([=]() {
+					vkDestroyCommandPool(_device, _frames[i]._recordCommandPools[c], nullptr);
+					});
+			}
+		}
+
+		//the upload context gets its own pool so immediate submits never reset a frame's command buffer
+		VkCommandPoolCreateInfo uploadCommandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily);
+		VK_CHECK(vkCreateCommandPool(_device, &uploadCommandPoolInfo, nullptr, &_uploadContext._commandPool));
+
+		VkCommandBufferAllocateInfo uploadCmdAllocInfo = vkinit::command_buffer_allocate_info(_uploadContext._commandPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &uploadCmdAllocInfo, &_uploadContext._commandBuffer));
+
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroyCommandPool(_device, _uploadContext._commandPool, nullptr);
+			});
 	}
 
 	void init_sync_structures() {
@@ -611,197 +1366,217 @@ class VulkanEngine {
 				vkDestroySemaphore(_device, _frames[i]._renderSemaphore, nullptr);
 				});
 		}
-	}
-
-	//loads a shader module from a spir-v file. Returns false if it errors.
-	bool load_shader_module(const char* filePath, VkShaderModule* outShaderModule) {
-		//open the file, with cursor at end.
-		std::ifstream file(filePath, std::ios::ate | std::ios::binary);
-
-		if (!file.is_open()) {
-			return false;
-		}
-
-		//Find what the size of the file is by looking up the location of the cursor.
-		//File opened with cursor at end, so cursor position = file length.
-		size_t fileSize = (size_t)file.tellg();
 
-		//spirv expects the buffer to be on uint32_t boundary, so make sure to reserive a buffer big enough for the entire file
-		std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
-
-		//put file cursor at start
-		file.seekg(0);
-
-		//load the entire file into buffer
-		file.read((char*)buffer.data(), fileSize);
-
-		//close file after loading data
-		file.close();
-
-		//create a new shader module, using the buffer we loaded
-		VkShaderModuleCreateInfo createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		//codeSize has to be in bytes, so multiply the ints in the buffer by sizeof into to get real size
-		createInfo.codeSize = buffer.size() * sizeof(uint32_t);
-		createInfo.pCode = buffer.data();
-
-		//check that create succeeds.
-		VkShaderModule shaderModule;
-		if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-			return false;
-		}
-		*outShaderModule = shaderModule;
-		return true;
-	}
-	void init_descriptors() {
-		//create a descriptor pool that will hold 10 uniform buffers
-		std::vector<VkDescriptorPoolSize> sizes = {
-			{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,10},
-			{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,10},
-			{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,10}
-		};
-
-		VkDescriptorPoolCreateInfo poolInfo{};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.flags = 0;
-		poolInfo.maxSets = 10;
-		poolInfo.poolSizeCount = (uint32_t)sizes.size();
-		poolInfo.pPoolSizes = sizes.data();
-
-		vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_descriptorPool);
+		//upload fence starts unsignaled, immediate_submit waits on it right after submitting
+		VkFenceCreateInfo uploadFenceCreateInfo = vkinit::fence_create_info();
+		VK_CHECK(vkCreateFence(_device, &uploadFenceCreateInfo, nullptr, &_uploadContext._uploadFence));
 
 		_mainDeletionQueue.push_function([=]() {
-			vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
-			});
-
-		VkDescriptorSetLayoutBinding cameraBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0);
-		VkDescriptorSetLayoutBinding sceneBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
-
-		VkDescriptorSetLayoutBinding bindings[] = { cameraBind, sceneBind };
-
-		VkDescriptorSetLayoutCreateInfo setInfo{};
-		setInfo.bindingCount = 2;
-		setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		setInfo.pBindings = bindings;
-
-		vkCreateDescriptorSetLayout(_device, &setInfo, nullptr, &_globalSetLayout);
-
-
-		_mainDeletionQueue.push_function([=] {
-			vkDestroyDescriptorSetLayout(_device, _globalSetLayout, nullptr);
-			});
-		VkDescriptorSetLayoutBinding objectBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0);
-
-		VkDescriptorSetLayoutCreateInfo setInfo2{};
-		setInfo2.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		setInfo2.bindingCount = 1;
-		setInfo2.pBindings = &objectBind;
-
-		vkCreateDescriptorSetLayout(_device, &setInfo2, nullptr, &_objectSetLayout);
-
-
-		_mainDeletionQueue.push_function([=] {
-			vkDestroyDescriptorSetLayout(_device, _objectSetLayout, nullptr);
+			vkDestroyFence(_device, _uploadContext._uploadFence, nullptr);
 			});
+	}
 
-		const size_t sceneParamBufferSize = FRAME_OVERLAP * pad_uniform_buffer_size(sizeof(GPUSceneData));
+	void init_descriptors() {
+		//descriptor pools are created on demand by the allocators, so there's nothing to size up front
+		_descriptorAllocator.init(_device);
+		_descriptorLayoutCache.init(_device);
 
-		_sceneParameterBuffer = create_buffer(sceneParamBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 		_mainDeletionQueue.push_function([=]() {
-			vmaDestroyBuffer(_allocator, _sceneParameterBuffer._buffer, _sceneParameterBuffer._allocation);
+			_descriptorAllocator.cleanup();
+			_descriptorLayoutCache.cleanup();
 			});
 
 		for (int i = 0; i < FRAME_OVERLAP; i++)
 		{
-			_frames[i]._cameraBuffer = create_buffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			FrameAllocator& frameAllocator = _frames[i]._frameAllocator;
+			frameAllocator._buffer = create_buffer(FRAME_ALLOCATOR_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT, (void**)&frameAllocator._mapped);
+			frameAllocator._capacity = FRAME_ALLOCATOR_SIZE;
 			_frames[i]._frameDeletionQueue.push_function([=]() {
-				vmaDestroyBuffer(_allocator, _frames[i]._cameraBuffer._buffer, _frames[i]._cameraBuffer._allocation);
+				vmaDestroyBuffer(_allocator, _frames[i]._frameAllocator._buffer._buffer, _frames[i]._frameAllocator._buffer._allocation);
 				});
 
-
-			const int MAX_OBJECTS = 10000;
-
-			_frames[i]._objectBuffer = create_buffer(sizeof(GPUObjectData) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-			_frames[i]._frameDeletionQueue.push_function([=]() {
-				vmaDestroyBuffer(_allocator, _frames[i]._objectBuffer._buffer, _frames[i]._objectBuffer._allocation);
-				});
-			VkDescriptorSetAllocateInfo allocInfo{};
-			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-			allocInfo.descriptorPool = _descriptorPool;
-			allocInfo.descriptorSetCount = 1;
-			allocInfo.pSetLayouts = &_globalSetLayout;
-
-			vkAllocateDescriptorSets(_device, &allocInfo, &_frames[i]._globalDescriptor);
-
-			VkDescriptorSetAllocateInfo objectAlloc{};
-			objectAlloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-			objectAlloc.descriptorPool = _descriptorPool;
-			objectAlloc.descriptorSetCount = 1;
-			objectAlloc.pSetLayouts = &_objectSetLayout;
-
-			vkAllocateDescriptorSets(_device, &objectAlloc, &_frames[i]._objectDescriptor);
-
+			//all three descriptors point at offset 0 of the frame allocator buffer, the real offset is the dynamic one
 			VkDescriptorBufferInfo cameraInfo{};
-			cameraInfo.buffer = _frames[i]._cameraBuffer._buffer;
+			cameraInfo.buffer = frameAllocator._buffer._buffer;
 			cameraInfo.offset = 0;
 			cameraInfo.range = sizeof(GPUCameraData);
 
 			VkDescriptorBufferInfo sceneInfo{};
-			sceneInfo.buffer = _sceneParameterBuffer._buffer;
+			sceneInfo.buffer = frameAllocator._buffer._buffer;
 			sceneInfo.offset = 0;
 			sceneInfo.range = sizeof(GPUSceneData);
 
 			VkDescriptorBufferInfo objectBufferInfo{};
-			objectBufferInfo.buffer = _frames[i]._objectBuffer._buffer;
+			objectBufferInfo.buffer = frameAllocator._buffer._buffer;
 			objectBufferInfo.offset = 0;
 			objectBufferInfo.range = sizeof(GPUObjectData) * MAX_OBJECTS;
 
-			VkWriteDescriptorSet cameraWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _frames[i]._globalDescriptor, &cameraInfo, 0);
+			//every per-frame binding is dynamic, the offsets come from the frame allocator at bind time.
+			//the layouts come out of the cache, so both frames share the same two layouts.
+			//use_layout narrows the stage flags to the stages the shaders use, and reports any binding they disagree on
+			DescriptorBuilder::begin(&_descriptorLayoutCache, &_descriptorAllocator)
+				.use_layout(_meshProgram.get_set_bindings(0))
+				.bind_buffer(0, &cameraInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT)
+				.bind_buffer(1, &sceneInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+				.build(_frames[i]._globalDescriptor, _globalSetLayout);
+
+			DescriptorBuilder::begin(&_descriptorLayoutCache, &_descriptorAllocator)
+				.use_layout(_meshProgram.get_set_bindings(1))
+				.bind_buffer(0, &objectBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT)
+				.build(_frames[i]._objectDescriptor, _objectSetLayout);
+
+			//indirect commands and visible matrices are only touched by the gpu. There are never more runs than objects
+			_frames[i]._indirectBuffer = create_buffer(sizeof(VkDrawIndexedIndirectCommand) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			_frames[i]._visibleObjectBuffer = create_buffer(sizeof(GPUObjectData) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			_frames[i]._frameDeletionQueue.push_function([=]() {
+				vmaDestroyBuffer(_allocator, _frames[i]._indirectBuffer._buffer, _frames[i]._indirectBuffer._allocation);
+				vmaDestroyBuffer(_allocator, _frames[i]._visibleObjectBuffer._buffer, _frames[i]._visibleObjectBuffer._allocation);
+				});
+
+			VkDescriptorBufferInfo cullObjectInfo{};
+			cullObjectInfo.buffer = frameAllocator._buffer._buffer;
+			cullObjectInfo.offset = 0;
+			cullObjectInfo.range = sizeof(GPUCullObject) * MAX_OBJECTS;
+
+			VkDescriptorBufferInfo commandInfo{};
+			commandInfo.buffer = _frames[i]._indirectBuffer._buffer;
+			commandInfo.offset = 0;
+			commandInfo.range = VK_WHOLE_SIZE;
+
+			VkDescriptorBufferInfo visibleObjectInfo{};
+			visibleObjectInfo.buffer = _frames[i]._visibleObjectBuffer._buffer;
+			visibleObjectInfo.offset = 0;
+			visibleObjectInfo.range = sizeof(GPUObjectData) * MAX_OBJECTS;
+
+			//object matrices and culling input are per-frame allocations too, so they are dynamic like the graphics sets
+			DescriptorBuilder::begin(&_descriptorLayoutCache, &_descriptorAllocator)
+				.use_layout(_cullProgram.get_set_bindings(0))
+				.bind_buffer(0, &objectBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT)
+				.bind_buffer(1, &cullObjectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT)
+				.bind_buffer(2, &commandInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+				.bind_buffer(3, &visibleObjectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+				.build(_frames[i]._cullDescriptor, _cullSetLayout);
+
+			//the vertex shader reads the culled matrices through the regular object set layout
+			DescriptorBuilder::begin(&_descriptorLayoutCache, &_descriptorAllocator)
+				.use_layout(_meshProgram.get_set_bindings(1))
+				.bind_buffer(0, &visibleObjectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT)
+				.build(_frames[i]._visibleObjectDescriptor);
+		}
+
+	}
+	//creates the pipeline cache from the file written by the last run, if it was written by this driver and gpu
+	void init_pipeline_cache() {
+		std::vector<char> cacheData;
+		std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+		if (file.is_open()) {
+			size_t fileSize = (size_t)file.tellg();
+			cacheData.resize(fileSize);
+			file.seekg(0);
+			file.read(cacheData.data(), fileSize);
+			file.close();
+		}
+
+		if (!cacheData.empty() && !pipeline_cache_matches_device(cacheData)) {
+			std::cout << "Pipeline cache " << PIPELINE_CACHE_PATH << " is from a different gpu or driver, starting empty" << std::endl;
+			cacheData.clear();
+		}
 
-			VkWriteDescriptorSet sceneWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, _frames[i]._globalDescriptor, &sceneInfo, 1);
+		VkPipelineCacheCreateInfo cacheInfo{};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = cacheData.size();
+		cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
 
-			VkWriteDescriptorSet objectWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i]._objectDescriptor, &objectBufferInfo, 0);
+		VK_CHECK(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_pipelineCache));
 
-			VkWriteDescriptorSet setWrites[] = { cameraWrite, sceneWrite, objectWrite };
+		_pipelineStateCache.init(_device, _pipelineCache);
 
-			vkUpdateDescriptorSets(_device, 3, setWrites, 0, nullptr);
+		_mainDeletionQueue.push_function([=]() {
+			_pipelineStateCache.cleanup();
+			vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+			});
 
+		std::cout << "Pipeline cache created with " << cacheData.size() << " bytes of initial data" << std::endl;
+	}
 
+	//checks the header the driver puts in front of the cache data (VK_PIPELINE_CACHE_HEADER_VERSION_ONE) against this gpu.
+	//drivers should reject foreign data themselves, but not all of them do
+	bool pipeline_cache_matches_device(const std::vector<char>& cacheData) {
+		const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+		if (cacheData.size() < headerSize) {
+			return false;
 		}
 
+		uint32_t header[4];	//header size, header version, vendor id, device id
+		memcpy(header, cacheData.data(), sizeof(header));
+		const uint8_t* uuid = (const uint8_t*)cacheData.data() + sizeof(header);
+
+		return header[0] >= headerSize
+			&& header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+			&& header[2] == _gpuProperties.vendorID
+			&& header[3] == _gpuProperties.deviceID
+			&& memcmp(uuid, _gpuProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
 	}
-	void init_pipelines() {
 
-		VkShaderModule	colorMeshShader;
-		if (!load_shader_module("Shaders/default_lit.frag.spv", &colorMeshShader)) {
-			std::cout << "Error when building the default lit shader." << std::endl;
+	void save_pipeline_cache() {
+		if (_pipelineCache == VK_NULL_HANDLE) {
+			return;
 		}
-		
-		VkShaderModule meshVertShader;
-		if (!load_shader_module("Shaders/tri_mesh_ssbo.vert.spv", &meshVertShader)) {
-			std::cout << "Error when building push constant vertex shader module" << std::endl;
+
+		size_t dataSize = 0;
+		VK_CHECK(vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, nullptr));
+		std::vector<char> cacheData(dataSize);
+		VK_CHECK(vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, cacheData.data()));
+
+		std::ofstream file(PIPELINE_CACHE_PATH, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cout << "Failed to write pipeline cache " << PIPELINE_CACHE_PATH << std::endl;
+			return;
 		}
-		else {
-			std::cout << "Push constant shader successfully loaded" << std::endl;
+		file.write(cacheData.data(), dataSize);
+		std::cout << "Saved " << dataSize << " bytes of pipeline cache" << std::endl;
+	}
+
+	//the shader registry, and the interface of the engine's programs that the layouts are made from
+	void init_shaders() {
+		_shaderCache.init(_device);
+
+		//files are read on demand by acquire_shader and reflect_program and watched for changes from then on
+		if (!_shaderWatcher.init("Shaders")) {
+			std::cout << "Could not watch the Shaders directory, shader hot reload is off" << std::endl;
 		}
 
-		PipelineBuilder pipelineBuilder;
+		_mainDeletionQueue.push_function([=]() {
+			_shaderCache.cleanup();
+			_shaderWatcher.cleanup();
+			});
 
-		//add the other shaders
-		pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
-		
-		pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, colorMeshShader));
+		if (!reflect_program({ MESH_VERTEX_SHADER_PATH, MESH_FRAGMENT_SHADER_PATH }, _meshProgram)) {
+			std::cout << "Could not reflect the mesh shaders, using the hand written layouts" << std::endl;
+		}
+		//the cull shader is optional, init_cull_pipeline reports it missing
+		if (_gpuCullingSupported) {
+			reflect_program({ CULL_SHADER_PATH }, _cullProgram);
+		}
+	}
+
+	void init_pipelines() {
+		PipelineBuilder pipelineBuilder;
 
 		//start from default empty pipeline layout
 		VkPipelineLayoutCreateInfo mesh_pipeline_layout_info = vkinit::pipeline_layout_create_info();
 
-		//setup push constants
+		//setup push constants, as the shaders declare them when they could be reflected
 		VkPushConstantRange push_constant;
 		push_constant.offset = 0;
 		push_constant.size = sizeof(MeshPushConstants);
 		push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;//for vertex shader
+		bool hasPushConstants = true;
+		if (_meshProgram.get_stages() != 0) {
+			hasPushConstants = _meshProgram.get_push_constant_range(push_constant);
+		}
 		mesh_pipeline_layout_info.pPushConstantRanges = &push_constant;
-		mesh_pipeline_layout_info.pushConstantRangeCount = 1;
+		mesh_pipeline_layout_info.pushConstantRangeCount = hasPushConstants ? 1 : 0;
 
 		VkDescriptorSetLayout setLayouts[] = { _globalSetLayout,_objectSetLayout };
 
@@ -848,60 +1623,259 @@ class VulkanEngine {
 		pipelineBuilder._depthStencil = vkinit::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
 
 		//build the mesh pipeline
-		VertexInputDescription vertexDescription = Vertex::get_vertex_description();
+		MaterialBuildRequest meshRequest;
+		meshRequest.name = "defaultMesh";
+		meshRequest.builder = pipelineBuilder;
+		meshRequest.shaders = {
+			{ VK_SHADER_STAGE_VERTEX_BIT, MESH_VERTEX_SHADER_PATH },
+			{ VK_SHADER_STAGE_FRAGMENT_BIT, MESH_FRAGMENT_SHADER_PATH }
+		};
+		meshRequest.vertexDescription = Vertex::get_vertex_description();
 
-		pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
-		pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexDescription.attributes.size());
+		//same material for meshes stored as CompactVertex, only the vertex input and shader differ
+		MaterialBuildRequest compactMeshRequest = meshRequest;
+		compactMeshRequest.name = meshRequest.name + COMPACT_MATERIAL_SUFFIX;
+		compactMeshRequest.shaders[0].second = MESH_COMPACT_VERTEX_SHADER_PATH;
+		compactMeshRequest.vertexDescription = CompactVertex::get_vertex_description();
 
-		pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
-		pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexDescription.bindings.size());
+		//every material pipeline goes through one parallel batch.
+		//materials that only differ in descriptors get the same pipeline back from the cache
+		std::vector<MaterialBuildRequest> materialRequests = { meshRequest, compactMeshRequest };
+		create_materials(materialRequests);
 
-		VkPipeline meshPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroyPipelineLayout(_device, meshPipelineLayout, nullptr);
+			});
+			
+		init_cull_pipeline();
 
-		create_material(meshPipeline, meshPipelineLayout, "defaultMesh");
+		PipelineStateCache::Stats pipelineStats = _pipelineStateCache.get_stats();
+		std::cout << "Pipeline cache: " << _pipelineStateCache.pipeline_count() << " pipelines, " << pipelineStats.hits << " hits, "
+			<< pipelineStats.misses << " misses, " << pipelineStats.failures << " failures" << std::endl;
 
+		//every module has been released by now, a nonzero count is a missing release
+		ShaderCache::Stats shaderStats = _shaderCache.get_stats();
+		std::cout << "Shader cache: " << shaderStats.filesRead << " files read, " << shaderStats.modulesCreated << " modules created, "
+			<< shaderStats.modulesShared << " shared, " << _shaderCache.module_count() << " still alive" << std::endl;
 
+		//every set is long lived, per frame data only changes the dynamic offsets they're bound with
+		DescriptorAllocator::Stats descriptorStats = _descriptorAllocator.get_stats();
+		std::cout << "Descriptors: " << descriptorStats.totalSetsAllocated << " sets in " << descriptorStats.poolsInUse << " pools ("
+			<< descriptorStats.freePools << " free, " << descriptorStats.poolsCreated << " created), " << _descriptorLayoutCache.layout_count() << " layouts" << std::endl;
 
+	}
 
+	//compute pipeline for gpu culling. If the shader or the device features are missing the cpu culling path is used instead
+	void init_cull_pipeline() {
+		if (!_gpuCullingSupported) {
+			std::cout << "drawIndirectFirstInstance not supported, using cpu culling" << std::endl;
+			return;
+		}
 
+		//prepare_gpu_culling pushes the whole GPUCullConstants, a shader declaring less would fail validation on every dispatch
+		VkPushConstantRange push_constant;
+		if (!_cullProgram.get_push_constant_range(push_constant) || push_constant.size < sizeof(GPUCullConstants)) {
+			std::cout << "Indirect cull shader missing or its push constants don't match GPUCullConstants, using cpu culling" << std::endl;
+			_gpuCullingSupported = false;
+			return;
+		}
 
-		vkDestroyShaderModule(_device, meshVertShader, nullptr);
-		vkDestroyShaderModule(_device, colorMeshShader, nullptr);
-		
+		ShaderCache::Module cullShader = _shaderCache.acquire(CULL_SHADER_PATH);
+		if (cullShader.module == VK_NULL_HANDLE) {
+			std::cout << "Error when building the indirect cull compute shader, using cpu culling" << std::endl;
+			_gpuCullingSupported = false;
+			return;
+		}
+
+		VkPipelineLayoutCreateInfo cull_pipeline_layout_info = vkinit::pipeline_layout_create_info();
+		cull_pipeline_layout_info.pPushConstantRanges = &push_constant;
+		cull_pipeline_layout_info.pushConstantRangeCount = 1;
+		cull_pipeline_layout_info.setLayoutCount = 1;
+		cull_pipeline_layout_info.pSetLayouts = &_cullSetLayout;
+
+		VK_CHECK(vkCreatePipelineLayout(_device, &cull_pipeline_layout_info, nullptr, &_cullPipelineLayout));
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cullShader.module);
+		pipelineInfo.layout = _cullPipelineLayout;
+
+		VkResult result = vkCreateComputePipelines(_device, _pipelineCache, 1, &pipelineInfo, nullptr, &_cullPipeline);
+		_shaderCache.release(cullShader);
+
+		if (result != VK_SUCCESS) {
+			std::cout << "failed to create cull pipeline, using cpu culling" << std::endl;
+			vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+			_cullPipeline = VK_NULL_HANDLE;
+			_cullPipelineLayout = VK_NULL_HANDLE;
+			_gpuCullingSupported = false;
+			return;
+		}
 
 		_mainDeletionQueue.push_function([=]() {
-			vkDestroyPipeline(_device, meshPipeline, nullptr);
-					
-			vkDestroyPipelineLayout(_device, meshPipelineLayout, nullptr);
-			
+			vkDestroyPipeline(_device, _cullPipeline, nullptr);
+			vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
 			});
-			
-		
 
+		std::cout << "GPU culling enabled" << std::endl;
 	}
-	void upload_mesh(Mesh& mesh) {
-		//allocate vertex buffer
-		VkBufferCreateInfo bufferInfo{};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = mesh._vertices.size() * sizeof(Vertex);
-		bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	//instantly submits the commands recorded by function and blocks until the gpu has executed them
+	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function) {
+		VkCommandBuffer cmd = _uploadContext._commandBuffer;
 
-		//let the VMA library know that this date should be writeable by CPU, but also readable by GPU
-		VmaAllocationCreateInfo vmaallocInfo{};
-		vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-		//allocate the buffer
-		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &mesh._vertexBuffer._buffer, &mesh._vertexBuffer._allocation, nullptr));
+		//the command buffer is used exactly once before being reset
+		VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+		function(cmd);
+
+		VK_CHECK(vkEndCommandBuffer(cmd));
+
+		VkSubmitInfo submit = vkinit::submit_info(&cmd);
+
+		//_uploadFence will now block until the copy commands finish execution
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, _uploadContext._uploadFence));
+
+		vkWaitForFences(_device, 1, &_uploadContext._uploadFence, true, 9999999999);
+		vkResetFences(_device, 1, &_uploadContext._uploadFence);
+
+		//reset the command buffers inside the command pool
+		vkResetCommandPool(_device, _uploadContext._commandPool, 0);
+	}
+
+	//the shared vertex and index buffers every mesh is uploaded into
+	void init_mesh_buffers() {
+		_meshVertexBuffer = create_buffer(MESH_VERTEX_BUFFER_SIZE, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		_meshIndexBuffer = create_buffer((size_t)MESH_INDEX_CAPACITY * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		_meshVertexRanges.init(MESH_VERTEX_BUFFER_SIZE);
+		_meshIndexRanges.init(MESH_INDEX_CAPACITY);
 
-		//add the descrution of triangle mesh buffer to the deletion queue
 		_mainDeletionQueue.push_function([=]() {
-			vmaDestroyBuffer(_allocator, mesh._vertexBuffer._buffer, mesh._vertexBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _meshVertexBuffer._buffer, _meshVertexBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _meshIndexBuffer._buffer, _meshIndexBuffer._allocation);
+			});
+	}
+
+	//reserves the mesh's ranges of the shared buffers, false if either one is out of space.
+	//the vertex range is aligned to the mesh's stride, so its start is a whole number of vertices in its own format
+	bool allocate_mesh_ranges(Mesh& mesh) {
+		uint32_t stride = mesh.vertex_stride();
+		uint32_t vertexBytes = (uint32_t)mesh.vertex_buffer_size();
+		uint32_t indexCount = (uint32_t)mesh.index_count();
+		uint32_t vertexByteOffset;
+		if (!_meshVertexRanges.allocate(vertexBytes, vertexByteOffset, stride)) {
+			std::cout << "Mesh vertex buffer is full, " << mesh.vertex_count() << " vertices don't fit" << std::endl;
+			return false;
+		}
+		if (!_meshIndexRanges.allocate(indexCount, mesh._firstIndex)) {
+			std::cout << "Mesh index buffer is full, " << indexCount << " indices don't fit" << std::endl;
+			_meshVertexRanges.free(vertexByteOffset, vertexBytes);
+			return false;
+		}
+		mesh._vertexOffset = vertexByteOffset / stride;
+		return true;
+	}
+
+	//gives a mesh's ranges back once no frame in flight can still be drawing from them
+	void release_mesh_ranges(const Mesh& mesh) {
+		uint32_t vertexByteOffset = mesh._vertexOffset * mesh.vertex_stride();
+		uint32_t vertexBytes = (uint32_t)mesh.vertex_buffer_size();
+		uint32_t firstIndex = mesh._firstIndex;
+		uint32_t indexCount = (uint32_t)mesh.index_count();
+		defer_deletion([=]() {
+			_meshVertexRanges.free(vertexByteOffset, vertexBytes);
+			_meshIndexRanges.free(firstIndex, indexCount);
 			});
+	}
 
-		//copy vertex data
-		void* data;
-		vmaMapMemory(_allocator, mesh._vertexBuffer._allocation, &data);
-		memcpy(data, mesh._vertices.data(), mesh._vertices.size() * sizeof(Vertex));
-		vmaUnmapMemory(_allocator, mesh._vertexBuffer._allocation);
+	void upload_mesh(Mesh& mesh) {
+		Mesh* meshes[] = { &mesh };
+		upload_meshes(meshes, 1);
+	}
+
+	//copies every mesh into one staging buffer, then copies from there into each mesh's ranges of the shared buffers in a single submit
+	void upload_meshes(Mesh** meshes, size_t count) {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		//meshes that don't fit are dropped from the batch and stay non-resident
+		std::vector<Mesh*> fitting;
+		size_t stagingSize = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (!allocate_mesh_ranges(*meshes[i])) {
+				continue;
+			}
+			fitting.push_back(meshes[i]);
+			stagingSize += meshes[i]->vertex_buffer_size() + meshes[i]->index_count() * sizeof(uint32_t);
+		}
+		meshes = fitting.data();
+		count = fitting.size();
+		if (stagingSize == 0) {
+			for (size_t i = 0; i < count; i++) {
+				meshes[i]->_resident = true;
+			}
+			return;
+		}
+
+		//cpu side staging buffer, only used as a transfer source
+		AllocatedBuffer stagingBuffer = create_buffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+		char* stagingData;
+		vmaMapMemory(_allocator, stagingBuffer._allocation, (void**)&stagingData);
+
+		std::vector<VkDeviceSize> vertexOffsets(count);
+		std::vector<VkDeviceSize> indexOffsets(count);
+		VkDeviceSize offset = 0;
+		for (size_t i = 0; i < count; i++) {
+			Mesh& mesh = *meshes[i];
+			const size_t vertexBytes = mesh.vertex_buffer_size();
+			const size_t indexBytes = mesh.index_count() * sizeof(uint32_t);
+
+			vertexOffsets[i] = offset;
+			memcpy(stagingData + offset, mesh.vertex_buffer_data(), vertexBytes);
+			offset += vertexBytes;
+
+			indexOffsets[i] = offset;
+			memcpy(stagingData + offset, mesh.index_data(), indexBytes);
+			offset += indexBytes;
+		}
+
+		vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+
+		immediate_submit([&](VkCommandBuffer cmd) {
+			for (size_t i = 0; i < count; i++) {
+				Mesh& mesh = *meshes[i];
+				//a copy region can't be empty, a mesh without vertices or indices just skips that copy
+				VkBufferCopy copy;
+				copy.srcOffset = vertexOffsets[i];
+				copy.dstOffset = (VkDeviceSize)mesh._vertexOffset * mesh.vertex_stride();
+				copy.size = mesh.vertex_buffer_size();
+				if (copy.size > 0) {
+					vkCmdCopyBuffer(cmd, stagingBuffer._buffer, _meshVertexBuffer._buffer, 1, &copy);
+				}
+
+				copy.srcOffset = indexOffsets[i];
+				copy.dstOffset = (VkDeviceSize)mesh._firstIndex * sizeof(uint32_t);
+				copy.size = mesh.index_count() * sizeof(uint32_t);
+				if (copy.size > 0) {
+					vkCmdCopyBuffer(cmd, stagingBuffer._buffer, _meshIndexBuffer._buffer, 1, &copy);
+				}
+			}
+			});
+
+		//the fence has signaled, so the staging memory is no longer in use
+		vmaDestroyBuffer(_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+		for (size_t i = 0; i < count; i++) {
+			meshes[i]->_resident = true;
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Uploaded " << count << " meshes, " << stagingSize / 1024 << " KB in " << seconds * 1000.0 << " ms ("
+			<< (seconds > 0.0 ? (stagingSize / (1024.0 * 1024.0)) / seconds : 0.0) << " MB/s)" << std::endl;
+
+		RangeAllocator::Stats vertexStats = _meshVertexRanges.get_stats();
+		RangeAllocator::Stats indexStats = _meshIndexRanges.get_stats();
+		std::cout << "Mesh buffers: " << vertexStats.used / 1024 << "/" << vertexStats.capacity / 1024 << " KB of vertices, "
+			<< indexStats.used << "/" << indexStats.capacity << " indices" << std::endl;
 	}
 	void load_meshes() {
 		Mesh triMesh{};
@@ -915,6 +1889,9 @@ class VulkanEngine {
 		triMesh._vertices[0].color = { 0.0f,1.0f,0.0f };//pure green
 		triMesh._vertices[1].color = { 0.0f,1.0f,0.0f };
 		triMesh._vertices[2].color = { 0.0f,1.0f,0.0f };
+		//single triangle, so the index list is trivial
+		triMesh._indices = { 0,1,2 };
+		triMesh.compute_bounds();
 
 		////make the array 3 vertices long
 		//_triangleMesh._vertices.resize(3);
@@ -928,20 +1905,131 @@ class VulkanEngine {
 		//_triangleMesh._vertices[1].color = { 0.0f,1.0f,0.0f };
 		//_triangleMesh._vertices[2].color = { 0.0f,1.0f,0.0f };
 
-		//load the monkey
-		Mesh monkeyMesh{};
-		monkeyMesh.load_from_obj("assets/monkey_smooth.obj");
-
-
-		//load the monkey
 		//_monkeyMesh.load_from_obj("assets/monkey_smooth.obj");
 		//upload_mesh(_triangleMesh);
 		//upload_mesh(_monkeyMesh);
-		upload_mesh(triMesh);
-		upload_mesh(monkeyMesh);
-		
-		_meshes["monkey"] = monkeyMesh;
 		_meshes["triangle"] = triMesh;
+
+		//file meshes are parsed on the job system, each one uses the binary cache in assets/<name>.mesh once it has been written
+		std::vector<MeshLoadRequest> requests = {
+			{"monkey","assets/monkey_smooth.obj", VertexFormat::Compact}
+		};
+		load_mesh_batch(requests);
+
+		upload_pending_meshes();
+
+		//everything else the scene uses is streamed, the first frames don't wait for it and it appears as it lands
+		std::vector<MeshLoadRequest> streamed = {
+			{"monkey_full","assets/monkey_smooth.obj", VertexFormat::Full}
+		};
+		stream_meshes(streamed);
+	}
+
+	//compact meshes can only be drawn once the compact material variants exist, without their shader meshes stay full
+	bool compact_meshes_supported() {
+		if (get_material(std::string("defaultMesh") + COMPACT_MATERIAL_SUFFIX) == nullptr) {
+			std::cout << "No compact mesh material, compact meshes are loaded with full vertices" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	//parses every requested mesh in parallel on the worker threads, then uploads them together on this thread
+	void load_mesh_batch(const std::vector<MeshLoadRequest>& requests) {
+		std::vector<Mesh> loaded(requests.size());
+		std::vector<uint8_t> succeeded(requests.size(), 0);
+		const bool compactSupported = compact_meshes_supported();
+
+		_jobSystem.parallel_for((uint32_t)requests.size(), [&](uint32_t i) {
+			succeeded[i] = loaded[i].load_from_file(requests[i].path.c_str()) ? 1 : 0;
+			if (succeeded[i] && requests[i].format == VertexFormat::Compact && compactSupported) {
+				loaded[i].compact();
+			}
+			});
+
+		for (size_t i = 0; i < requests.size(); i++) {
+			if (!succeeded[i]) {
+				std::cout << "Failed to load mesh " << requests[i].path << std::endl;
+				continue;
+			}
+			_meshes[requests[i].name] = std::move(loaded[i]);
+		}
+	}
+
+	//kicks off copies for freshly parsed meshes and finishes the ones the transfer queue is done with. Called outside the render pass.
+	void update_streaming(VkCommandBuffer cmd) {
+		std::vector<std::pair<std::string, Mesh>> parsed;
+		{
+			std::lock_guard<std::mutex> lock(_streamMutex);
+			parsed.swap(_streamedMeshes);
+		}
+
+		for (auto& entry : parsed) {
+			auto mesh = std::make_shared<Mesh>(std::move(entry.second));
+			const size_t vertexBytes = mesh->vertex_buffer_size();
+			const size_t indexBytes = mesh->index_count() * sizeof(uint32_t);
+
+			if (!allocate_mesh_ranges(*mesh)) {
+				std::cout << "Dropping streamed mesh " << entry.first << std::endl;
+				continue;
+			}
+
+			//the copies only touch this mesh's ranges, frames in flight keep drawing from the rest of the buffers
+			_uploader.upload_buffer(mesh->vertex_buffer_data(), vertexBytes, _meshVertexBuffer._buffer, (VkDeviceSize)mesh->_vertexOffset * mesh->vertex_stride(), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+			_uploader.upload_buffer(mesh->index_data(), indexBytes, _meshIndexBuffer._buffer, (VkDeviceSize)mesh->_firstIndex * sizeof(uint32_t), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+
+			std::string name = entry.first;
+			_uploader.submit([this, mesh, name]() {
+				//a mesh streamed in again under the same name replaces the old one, whose ranges go back once nothing draws them
+				auto it = _meshes.find(name);
+				if (it != _meshes.end() && it->second._resident) {
+					release_mesh_ranges(it->second);
+				}
+				mesh->_resident = true;
+				if (it != _meshes.end() && it->second._format != mesh->_format) {
+					set_mesh_material_format(&it->second, mesh->_format);
+				}
+				_meshes[name] = *mesh;
+				});
+		}
+
+		_uploader.poll(cmd);
+	}
+
+	//points the objects drawing mesh at the variant of their material for format, when a mesh is replaced by one stored differently
+	void set_mesh_material_format(const Mesh* mesh, VertexFormat format) {
+		const std::string suffix = COMPACT_MATERIAL_SUFFIX;
+		for (RenderObject& object : _renderables) {
+			if (object.mesh != mesh) {
+				continue;
+			}
+			for (auto& it : _materials) {
+				if (&it.second != object.material) {
+					continue;
+				}
+				std::string name = it.first;
+				if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+					name.resize(name.size() - suffix.size());
+				}
+				Material* variant = get_material(format == VertexFormat::Compact ? name + suffix : name);
+				if (variant != nullptr) {
+					object.material = variant;
+				}
+				break;
+			}
+		}
+	}
+
+	//uploads every mesh that isn't in the shared buffers yet in one staging copy.
+	//placeholders of meshes still streaming in have no vertices yet, the streaming upload takes care of them
+	void upload_pending_meshes() {
+		std::vector<Mesh*> pending;
+		for (auto& it : _meshes) {
+			if (!it.second._resident && it.second.vertex_count() > 0) {
+				pending.push_back(&it.second);
+			}
+		}
+		upload_meshes(pending.data(), pending.size());
 	}
 	FrameData& get_current_frame() {
 		return _frames[_frameNumber % FRAME_OVERLAP];
@@ -959,6 +2047,8 @@ public:
 		glfwSetFramebufferSizeCallback(_window, framebufferResizeCallback);
 		glfwSetKeyCallback(_window, keyCallback);
 
+		_jobSystem.init();
+
 		init_vulkan();
 
 		init_swapchain();
@@ -971,10 +2061,16 @@ public:
 
 		init_sync_structures();
 
+		init_shaders();
+
 		init_descriptors();
 
+		init_pipeline_cache();
+
 		init_pipelines();
 
+		init_mesh_buffers();
+
 		load_meshes();
 
 		init_scene();
@@ -993,6 +2089,11 @@ public:
 			//vkDestroyDescriptorSetLayout(_device, _globalSetLayout, nullptr);
 			//vkDestroyDescriptorSetLayout(_device, _objectSetLayout, nullptr);
 			//vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
+			//the fences above mean no frame is still using anything that was waiting to be destroyed
+			flush_deferred_deletions(true);
+
+			//write the cache back before the deletion queue destroys it, the next launch starts from everything compiled this run
+			save_pipeline_cache();
 			_mainDeletionQueue.flush();
 			
 
@@ -1007,15 +2108,49 @@ public:
 			glfwDestroyWindow(_window);
 			glfwTerminate();
 		}
+		_jobSystem.shutdown();
 	}
+	//parses meshes as background jobs and uploads them through the async uploader while frames keep rendering.
+	//a name that isn't loaded yet gets an empty mesh right away, so objects can be set up with get_mesh() before the data arrives.
+	//they're skipped until the mesh's copy has finished, and a mesh streamed again under the same name replaces the old one in place
+	void stream_meshes(const std::vector<MeshLoadRequest>& requests) {
+		const bool compactSupported = compact_meshes_supported();
+		for (const MeshLoadRequest& request : requests) {
+			const bool compact = request.format == VertexFormat::Compact && compactSupported;
+			if (_meshes.find(request.name) == _meshes.end()) {
+				//the placeholder's format picks the material variant objects get, it has to match what will arrive
+				_meshes[request.name]._format = compact ? VertexFormat::Compact : VertexFormat::Full;
+			}
+			_jobSystem.submit_background([this, request, compact]() {
+				Mesh mesh;
+				if (!mesh.load_from_file(request.path.c_str())) {
+					std::cout << "Failed to load mesh " << request.path << std::endl;
+					return;
+				}
+				if (compact) {
+					mesh.compact();
+				}
+				std::lock_guard<std::mutex> lock(_streamMutex);
+				_streamedMeshes.emplace_back(request.name, std::move(mesh));
+				});
+		}
+	}
+
 	void draw() {
 		//wait until the gpu has finished rendering the last frame. Timeout of 1 sec.
-		auto frame = get_current_frame();
+		auto& frame = get_current_frame();
 		VK_CHECK(vkWaitForFences(_device, 1, &frame._renderFence, true, 1000000000));
 		VK_CHECK(vkResetFences(_device, 1, &frame._renderFence));
 
+		//the gpu is done with this frame's transient data, so it can be handed out again
+		flush_deferred_deletions(false);
+		frame._frameAllocator.reset();
+
 		//now that we are sure that the commands finished executing, we can safely reset the command buffer to begin recording again.
 		VK_CHECK(vkResetCommandBuffer(frame._mainCommandBuffer, 0));
+		for (VkCommandPool pool : frame._recordCommandPools) {
+			VK_CHECK(vkResetCommandPool(_device, pool, 0));
+		}
 
 		//request image from the swapchain
 		uint32_t swapchainImageIndex;
@@ -1029,6 +2164,12 @@ public:
 
 		VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+		//take ownership of any finished streaming uploads before the render pass uses them
+		update_streaming(cmd);
+
+		//swap in pipelines for shaders that changed on disk before anything is recorded with the old ones
+		reload_changed_shaders();
+
 		//make a clear-color from frame number. This wil flash with a 120 frame period
 		VkClearValue clearValue;
 		float flash = abs(sin(_frameNumber / 120.f));
@@ -1050,9 +2191,20 @@ public:
 
 		
 
-		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+		//uniforms, object data and the culling dispatch, which can't be recorded inside a render pass
+		prepare_draws(cmd, _renderables.data(), (int)_renderables.size());
 
-		draw_objects(cmd, _renderables.data(),(int) _renderables.size());
+		//big draw lists are recorded across the worker threads, a render pass can only have inline or secondary contents
+		const bool parallelRecord = _recordChunkCount > 1 && draw_object_count() >= PARALLEL_RECORD_MIN_OBJECTS;
+
+		vkCmdBeginRenderPass(cmd, &rpInfo, parallelRecord ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+		if (parallelRecord) {
+			draw_objects_parallel(cmd, _framebuffers[swapchainImageIndex]);
+		}
+		else {
+			draw_objects(cmd, 0, draw_object_count());
+		}
 		
 
 		//finalize the render pass
@@ -1096,7 +2248,8 @@ public:
 		//increate the number of frames draw
 		_frameNumber++;
 	}
-	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage) {
+	//pass VMA_ALLOCATION_CREATE_MAPPED_BIT and outMapped to keep the buffer mapped for its whole lifetime
+	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags flags = 0, void** outMapped = nullptr) {
 		//allocate vertex buffer
 		VkBufferCreateInfo bufferInfo{};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1106,11 +2259,16 @@ public:
 		//let VMA library know that this data should be writeable by CPU, but also readable by GPU
 		VmaAllocationCreateInfo vmaAllocInfo{};
 		vmaAllocInfo.usage = memoryUsage;
+		vmaAllocInfo.flags = flags;
 
 		AllocatedBuffer newBuffer;
+		VmaAllocationInfo allocationInfo;
 		//allocate the buffer
-		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaAllocInfo, &newBuffer._buffer, &newBuffer._allocation, nullptr));
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaAllocInfo, &newBuffer._buffer, &newBuffer._allocation, &allocationInfo));
 
+		if (outMapped) {
+			*outMapped = allocationInfo.pMappedData;
+		}
 		return newBuffer;
 	}
 
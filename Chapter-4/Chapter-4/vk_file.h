@@ -0,0 +1,159 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//size and modification time of a file, used to tell if a derived file is stale
+struct FileStamp {
+	uint64_t	size = 0;
+	uint64_t	modifiedTime = 0;
+};
+
+inline bool get_file_stamp(const char* path, FileStamp& stamp) {
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path, &info) != 0) {
+		return false;
+	}
+#else
+	struct stat info;
+	if (stat(path, &info) != 0) {
+		return false;
+	}
+#endif
+	stamp.size = (uint64_t)info.st_size;
+	stamp.modifiedTime = (uint64_t)info.st_mtime;
+	return true;
+}
+
+//moves from over to, replacing it in one step so a reader sees either the old file or the whole new one, never a partial write.
+//mappings of the old file stay valid. Fails on Windows if the old file is open without sharing delete
+inline bool replace_file(const char* from, const char* to) {
+#ifdef _WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+//read-only memory mapping of a whole file. The OS pages the data in on demand,
+//so reading a large binary asset is just a pointer into the page cache.
+class MappedFile {
+	void*		_data = nullptr;
+	size_t		_size = 0;
+#ifdef _WIN32
+	HANDLE		_file = INVALID_HANDLE_VALUE;
+	HANDLE		_mapping = nullptr;
+#else
+	int			_fd = -1;
+#endif
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() {
+		close();
+	}
+
+	bool open(const char* path) {
+		close();
+#ifdef _WIN32
+		//sharing delete lets replace_file swap a new version in while this one is still mapped
+		_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (_file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(_file, &fileSize) || fileSize.QuadPart == 0) {
+			close();
+			return false;
+		}
+		_size = (size_t)fileSize.QuadPart;
+		_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (_mapping == nullptr) {
+			close();
+			return false;
+		}
+		_data = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+		if (_data == nullptr) {
+			close();
+			return false;
+		}
+#else
+		_fd = ::open(path, O_RDONLY);
+		if (_fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(_fd, &info) != 0 || info.st_size == 0) {
+			close();
+			return false;
+		}
+		_size = (size_t)info.st_size;
+		void* mapped = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+		if (mapped == MAP_FAILED) {
+			close();
+			return false;
+		}
+		_data = mapped;
+		//we read the blobs front to back exactly once
+		madvise(_data, _size, MADV_SEQUENTIAL);
+#endif
+		return true;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (_data) {
+			UnmapViewOfFile(_data);
+		}
+		if (_mapping) {
+			CloseHandle(_mapping);
+		}
+		if (_file != INVALID_HANDLE_VALUE) {
+			CloseHandle(_file);
+		}
+		_mapping = nullptr;
+		_file = INVALID_HANDLE_VALUE;
+#else
+		if (_data) {
+			munmap(_data, _size);
+		}
+		if (_fd >= 0) {
+			::close(_fd);
+		}
+		_fd = -1;
+#endif
+		_data = nullptr;
+		_size = 0;
+	}
+
+	const void* data() const {
+		return _data;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	bool is_open() const {
+		return _data != nullptr;
+	}
+};
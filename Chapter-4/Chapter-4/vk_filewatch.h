@@ -0,0 +1,130 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include "vk_file.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+//Reports files in one directory that were rewritten since the last poll.
+//On Linux an inotify watch on the directory delivers close-after-write and rename events, so polling is a non-blocking read.
+//Elsewhere the watched files are stat'ed at most every POLL_INTERVAL, comparing size and modification time.
+//Only files registered with watch() are reported, paths come back exactly as they were registered.
+class FileWatcher {
+public:
+	bool init(const std::string& directory) {
+		_directory = directory;
+#ifdef __linux__
+		_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (_inotify < 0) {
+			return false;
+		}
+		//editors and compilers either write in place or write a temp file and rename it over the old one
+		_watch = inotify_add_watch(_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (_watch < 0) {
+			close(_inotify);
+			_inotify = -1;
+			return false;
+		}
+#endif
+		return true;
+	}
+
+	void cleanup() {
+#ifdef __linux__
+		if (_inotify >= 0) {
+			close(_inotify);
+			_inotify = -1;
+		}
+#endif
+		_files.clear();
+	}
+
+	//path has to be inside the watched directory, like "Shaders/default_lit.frag.spv" for "Shaders". Watching a file twice does nothing
+	void watch(const std::string& path) {
+		size_t slash = path.find_last_of("/\\");
+		std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+		if (_files.find(name) != _files.end()) {
+			return;
+		}
+
+		WatchedFile file;
+		file.path = path;
+		get_file_stamp(path.c_str(), file.stamp);
+		_files[name] = file;
+	}
+
+	//appends every watched file that changed since the last call
+	void poll(std::vector<std::string>& changedFiles) {
+#ifdef __linux__
+		if (_inotify < 0) {
+			return;
+		}
+		alignas(struct inotify_event) char buffer[4096];
+		for (;;) {
+			ssize_t length = read(_inotify, buffer, sizeof(buffer));
+			if (length <= 0) {
+				break;	//EAGAIN, nothing left to read
+			}
+			for (char* ptr = buffer; ptr < buffer + length;) {
+				const struct inotify_event* event = (const struct inotify_event*)ptr;
+				if (event->len > 0) {
+					auto it = _files.find(event->name);
+					if (it != _files.end()) {
+						add_unique(changedFiles, it->second.path);
+					}
+				}
+				ptr += sizeof(struct inotify_event) + event->len;
+			}
+		}
+#else
+		auto now = std::chrono::steady_clock::now();
+		if (now - _lastPoll < POLL_INTERVAL) {
+			return;
+		}
+		_lastPoll = now;
+
+		for (auto& entry : _files) {
+			WatchedFile& file = entry.second;
+			FileStamp stamp;
+			if (!get_file_stamp(file.path.c_str(), stamp)) {
+				continue;	//mid-replace, try again next poll
+			}
+			if (stamp.size != file.stamp.size || stamp.modifiedTime != file.stamp.modifiedTime) {
+				file.stamp = stamp;
+				add_unique(changedFiles, file.path);
+			}
+		}
+#endif
+	}
+private:
+	struct WatchedFile {
+		std::string	path;
+		FileStamp	stamp;
+	};
+
+	static void add_unique(std::vector<std::string>& files, const std::string& path) {
+		for (const std::string& f : files) {
+			if (f == path) {
+				return;
+			}
+		}
+		files.push_back(path);
+	}
+
+	std::string			_directory;
+	std::unordered_map<std::string, WatchedFile>	_files;	//keyed by file name
+#ifdef __linux__
+	int					_inotify = -1;
+	int					_watch = -1;
+#else
+	const std::chrono::milliseconds			POLL_INTERVAL = std::chrono::milliseconds(250);
+	std::chrono::steady_clock::time_point	_lastPoll;
+#endif
+};
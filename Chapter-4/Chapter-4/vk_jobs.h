@@ -0,0 +1,175 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+//fixed pool of worker threads pulling jobs from two queues.
+//submit() and parallel_for() are for short work the caller is waiting on, like recording or pipeline builds, and always go first.
+//submit_background() is for long running asset work (parsing, optimizing, building LODs) that nobody waits on. It only runs on
+//workers, at most all but one of them at a time, so it can't hold up a parallel_for or take every thread.
+//jobs must not touch Vulkan objects that need external synchronization unless each job owns them,
+//like asset parsing or recording into a command buffer allocated from a pool only that job uses.
+class JobSystem {
+	//one parallel_for call. Items are taken with the atomic index by the caller and by any worker that picks up a helper job,
+	//so the caller only ever runs its own items. Shared so a helper that starts after the call returned finds nothing left
+	struct Batch {
+		const std::function<void(uint32_t)>*	function;
+		uint32_t								count;
+		std::atomic<uint32_t>					next{ 0 };
+		std::atomic<uint32_t>					finished{ 0 };
+		std::mutex								mutex;
+		std::condition_variable					done;
+
+		//runs items until there are none left to take
+		void run() {
+			for (;;) {
+				uint32_t i = next.fetch_add(1);
+				if (i >= count) {
+					return;
+				}
+				(*function)(i);
+				if (finished.fetch_add(1) + 1 == count) {
+					std::lock_guard<std::mutex> lock(mutex);
+					done.notify_all();
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread>			_workers;
+	std::deque<std::function<void()>>	_jobs;
+	std::deque<std::function<void()>>	_backgroundJobs;
+	std::mutex							_mutex;
+	std::condition_variable				_jobAvailable;
+	std::condition_variable				_allDone;
+	uint32_t							_pending = 0;	//queued plus running jobs of both kinds
+	uint32_t							_backgroundRunning = 0;
+	uint32_t							_maxBackground = 1;
+	bool								_stopping = false;
+
+	bool can_start_background() const {
+		return !_backgroundJobs.empty() && _backgroundRunning < _maxBackground;
+	}
+
+	void worker_loop() {
+		for (;;) {
+			std::function<void()> job;
+			bool background = false;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_jobAvailable.wait(lock, [this] { return _stopping || !_jobs.empty() || can_start_background(); });
+				if (!_jobs.empty()) {
+					job = std::move(_jobs.front());
+					_jobs.pop_front();
+				}
+				else if (can_start_background()) {
+					job = std::move(_backgroundJobs.front());
+					_backgroundJobs.pop_front();
+					_backgroundRunning++;
+					background = true;
+				}
+				else {
+					//stopping with nothing left that this worker may run
+					return;
+				}
+			}
+
+			job();
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (background) {
+				_backgroundRunning--;
+				//a background slot opened up, a waiting worker may be able to take the next one
+				_jobAvailable.notify_one();
+			}
+			if (--_pending == 0) {
+				_allDone.notify_all();
+			}
+		}
+	}
+public:
+	//threadCount of 0 uses one worker per hardware thread, leaving one for the main thread
+	void init(uint32_t threadCount = 0) {
+		if (threadCount == 0) {
+			uint32_t hw = std::thread::hardware_concurrency();
+			threadCount = hw > 1 ? hw - 1 : 1;
+		}
+		_stopping = false;
+		_maxBackground = std::max(1u, threadCount - 1);
+		for (uint32_t i = 0; i < threadCount; i++) {
+			_workers.emplace_back([this] { worker_loop(); });
+		}
+	}
+
+	//runs whatever is still queued, including background jobs, then joins the workers
+	void shutdown() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_jobAvailable.notify_all();
+		for (auto& worker : _workers) {
+			worker.join();
+		}
+		_workers.clear();
+	}
+
+	uint32_t worker_count() const {
+		return (uint32_t)_workers.size();
+	}
+
+	void submit(std::function<void()>&& job) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_jobs.push_back(std::move(job));
+			_pending++;
+		}
+		_jobAvailable.notify_one();
+	}
+
+	//queues long running work behind everything submitted with submit() and parallel_for()
+	void submit_background(std::function<void()>&& job) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_backgroundJobs.push_back(std::move(job));
+			_pending++;
+		}
+		_jobAvailable.notify_one();
+	}
+
+	//blocks until every submitted job, background ones included, has finished running
+	void wait_idle() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_allDone.wait(lock, [this] { return _pending == 0; });
+	}
+
+	//runs function(i) for i in [0,count) on the calling thread and any workers that are free, and returns once all of them are done.
+	//the caller works through the items itself rather than waiting, so it never runs anyone else's jobs, never waits behind them,
+	//and can be a job itself without deadlocking the pool
+	void parallel_for(uint32_t count, const std::function<void(uint32_t)>& function) {
+		if (count == 0) {
+			return;
+		}
+		auto batch = std::make_shared<Batch>();
+		batch->function = &function;
+		batch->count = count;
+
+		//the caller takes items too, so one helper fewer than items is enough
+		uint32_t helpers = std::min(count - 1, worker_count());
+		for (uint32_t i = 0; i < helpers; i++) {
+			submit([batch] { batch->run(); });
+		}
+
+		batch->run();
+
+		std::unique_lock<std::mutex> lock(batch->mutex);
+		batch->done.wait(lock, [&] { return batch->finished.load() == count; });
+	}
+};
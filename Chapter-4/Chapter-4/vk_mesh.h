@@ -6,6 +6,14 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
+#include "vk_file.h"
+#include "vk_meshopt.h"
+#include "vk_simplify.h"
+#include "vk_meshlets.h"
 
 struct VertexInputDescription {
 	std::vector<VkVertexInputBindingDescription> bindings;
@@ -54,11 +62,506 @@ struct Vertex {
 
 		return description;
 	}
+
+	bool operator==(const Vertex& other) const {
+		return position == other.position && normal == other.normal && color == other.color;
+	}
+};
+
+namespace std {
+	//hash the full (position, normal, color) tuple so identical obj corners collapse to one vertex
+	template<> struct hash<Vertex> {
+		size_t operator()(const Vertex& vertex) const {
+			size_t seed = hash<glm::vec3>()(vertex.position);
+			seed ^= hash<glm::vec3>()(vertex.normal) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			seed ^= hash<glm::vec3>()(vertex.color) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			return seed;
+		}
+	};
+}
+
+//quantized vertex, 16 bytes instead of 36.
+//position is snorm16 relative to the mesh bounds (w is padding), normal is octahedral encoded into two snorm16 and color is unorm8
+struct CompactVertex {
+	int16_t		position[4];
+	int16_t		normal[2];
+	uint8_t		color[4];
+	static VertexInputDescription get_vertex_description() {
+		VertexInputDescription description;
+		//same single per-vertex binding as Vertex, the formats do the unpacking to floats
+		VkVertexInputBindingDescription mainBinding;
+		mainBinding.binding = 0;
+		mainBinding.stride = sizeof(CompactVertex);
+		mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		description.bindings.push_back(mainBinding);
+
+		//Position will be stored at Location 0
+		VkVertexInputAttributeDescription positionAttribute{};
+		positionAttribute.binding = 0;
+		positionAttribute.location = 0;
+		positionAttribute.format = VK_FORMAT_R16G16B16A16_SNORM;
+		positionAttribute.offset = offsetof(CompactVertex, position);
+
+		//Normal will be stored at Location 1
+		VkVertexInputAttributeDescription normalAttribute{};
+		normalAttribute.binding = 0;
+		normalAttribute.location = 1;
+		normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+		normalAttribute.offset = offsetof(CompactVertex, normal);
+
+		//Color will be stored at Location 2
+		VkVertexInputAttributeDescription colorAttribute{};
+		colorAttribute.binding = 0;
+		colorAttribute.location = 2;
+		colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;
+		colorAttribute.offset = offsetof(CompactVertex, color);
+
+		description.attributes.push_back(positionAttribute);
+		description.attributes.push_back(normalAttribute);
+		description.attributes.push_back(colorAttribute);
+
+		return description;
+	}
+};
+
+//which of the two vertex layouts a mesh is stored in on the gpu, picked per mesh at load time
+enum class VertexFormat {
+	Full,		//Vertex
+	Compact		//CompactVertex
+};
+
+inline int16_t quantize_snorm16(float v) {
+	return (int16_t)roundf(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+inline uint8_t quantize_unorm8(float v) {
+	return (uint8_t)roundf(glm::clamp(v, 0.0f, 1.0f) * 255.0f);
+}
+
+//folds the unit sphere onto the octahedron and the lower half over the upper one, giving a point in [-1,1]^2.
+//a shader that lights with the normal undoes it by unfolding the lower half and normalizing
+inline glm::vec2 encode_octahedral(const glm::vec3& n) {
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l1 == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+	glm::vec2 e = glm::vec2(n.x, n.y) / l1;
+	if (n.z < 0.0f) {
+		glm::vec2 folded = glm::vec2(1.0f - fabsf(e.y), 1.0f - fabsf(e.x));
+		e.x = e.x >= 0.0f ? folded.x : -folded.x;
+		e.y = e.y >= 0.0f ? folded.y : -folded.y;
+	}
+	return e;
+}
+
+//axis aligned box plus the sphere around it, in mesh space
+struct MeshBounds {
+	glm::vec3	origin{ 0.0f };
+	float		radius = 0.0f;
+	glm::vec3	extents{ 0.0f };
+};
+
+//on-disk layout of a cached mesh: header, then the vertex blob, then the index blob.
+//bump MESH_FILE_VERSION whenever the header or blob layout changes, or the processing done before saving does, stale caches are rebuilt from the obj.
+constexpr uint32_t MESH_FILE_MAGIC = 0x4d474b56;//"VKGM"
+constexpr uint32_t MESH_FILE_VERSION = 4;
+
+//levels of detail per mesh including the full one, each one aims for half the triangles of the level before
+constexpr uint32_t MESH_MAX_LODS = 5;
+//no collapse in a level moves the surface further than this, relative to the mesh size
+constexpr float MESH_LOD_MAX_ERROR = 0.05f;
+
+//a level of detail is a range of the mesh's index list, all of them index the same vertices
+struct MeshLod {
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+	float		error;		//how far the level strays from the full mesh, in mesh units
+};
+
+struct MeshFileHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	vertexStride;
+	uint32_t	vertexCount;
+	uint32_t	indexCount;		//every level of detail, one after the other
+	uint32_t	lodCount;
+	uint32_t	meshletCount;
+	uint32_t	reserved;
+	uint64_t	sourceSize;		//size and timestamp of the obj this was built from
+	uint64_t	sourceTime;
+	float		boundsOrigin[3];
+	float		boundsRadius;
+	float		boundsExtents[3];
+	float		padding;
+	uint64_t	vertexOffset;	//byte offsets of the blobs from the start of the file
+	uint64_t	indexOffset;
+	uint64_t	lodOffset;		//MeshLod table
+	uint64_t	meshletOffset;	//Meshlet table
 };
 
 struct Mesh {
 	std::vector<Vertex>	_vertices;
-	AllocatedBuffer _vertexBuffer;
+	std::vector<uint32_t>	_indices;
+	MeshBounds	_bounds;
+	//index ranges of the levels of detail, finest first. Empty for meshes that only have the one level
+	std::vector<MeshLod>	_lods;
+	//clusters of the full detail level, for culling parts of a mesh
+	std::vector<Meshlet>	_meshlets;
+
+	//compact meshes keep only the quantized vertices, _quantizeScale is what the positions were divided by after subtracting the bounds origin
+	VertexFormat	_format = VertexFormat::Full;
+	std::vector<CompactVertex>	_compactVertices;
+	float		_quantizeScale = 1.0f;
+
+	//where the mesh lives in the engine's shared vertex and index buffers, counted in vertices of its format and indices. Valid once _resident is set
+	uint32_t	_vertexOffset = 0;
+	uint32_t	_firstIndex = 0;
+	bool		_resident = false;
+
+	//when loaded from a binary cache, the vertex and index blobs are read straight out of the mapped file
+	std::shared_ptr<MappedFile>	_mappedFile;
+	const Vertex*	_mappedVertices = nullptr;
+	const uint32_t*	_mappedIndices = nullptr;
+	uint32_t	_mappedVertexCount = 0;
+	uint32_t	_mappedIndexCount = 0;
+
+	const Vertex* vertex_data() const {
+		return _mappedVertices ? _mappedVertices : _vertices.data();
+	}
+	size_t vertex_count() const {
+		if (_format == VertexFormat::Compact) {
+			return _compactVertices.size();
+		}
+		return _mappedVertices ? _mappedVertexCount : _vertices.size();
+	}
+	const uint32_t* index_data() const {
+		return _mappedIndices ? _mappedIndices : _indices.data();
+	}
+	size_t index_count() const {
+		return _mappedIndices ? _mappedIndexCount : _indices.size();
+	}
+
+	uint32_t lod_count() const {
+		return _lods.empty() ? 1 : (uint32_t)_lods.size();
+	}
+	MeshLod get_lod(uint32_t level) const {
+		if (_lods.empty()) {
+			return MeshLod{ 0, (uint32_t)index_count(), 0.0f };
+		}
+		return _lods[glm::min(level, (uint32_t)_lods.size() - 1)];
+	}
+
+	//the vertices as they go into the vertex buffer, in whichever format the mesh is stored
+	const void* vertex_buffer_data() const {
+		if (_format == VertexFormat::Compact) {
+			return _compactVertices.data();
+		}
+		return vertex_data();
+	}
+	uint32_t vertex_stride() const {
+		return _format == VertexFormat::Compact ? (uint32_t)sizeof(CompactVertex) : (uint32_t)sizeof(Vertex);
+	}
+	size_t vertex_buffer_size() const {
+		return vertex_count() * vertex_stride();
+	}
+
+	//maps the stored positions into mesh space, identity unless the mesh is compact
+	glm::mat4 get_dequantize_matrix() const {
+		if (_format != VertexFormat::Compact) {
+			return glm::mat4{ 1.0f };
+		}
+		return glm::scale(glm::translate(glm::mat4{ 1.0f }, _bounds.origin), glm::vec3(_quantizeScale));
+	}
+
+	//bounding sphere in the space the stored positions are in, the one get_dequantize_matrix maps from
+	glm::vec4 get_vertex_sphere() const {
+		if (_format != VertexFormat::Compact) {
+			return glm::vec4(_bounds.origin, _bounds.radius);
+		}
+		return glm::vec4(0.0f, 0.0f, 0.0f, _bounds.radius / _quantizeScale);
+	}
+
+	//quantizes the vertices into _compactVertices and drops the full ones, the bounds have to be computed already.
+	//positions use one scale for every axis, so dequantizing is a translate and uniform scale and the bounding sphere stays a sphere
+	void compact() {
+		if (_format == VertexFormat::Compact) {
+			return;
+		}
+		const Vertex* vertices = vertex_data();
+		size_t count = vertex_count();
+
+		float scale = glm::max(_bounds.extents.x, glm::max(_bounds.extents.y, _bounds.extents.z));
+		_quantizeScale = scale > 0.0f ? scale : 1.0f;
+
+		_compactVertices.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			const Vertex& v = vertices[i];
+			CompactVertex& c = _compactVertices[i];
+
+			glm::vec3 position = (v.position - _bounds.origin) / _quantizeScale;
+			c.position[0] = quantize_snorm16(position.x);
+			c.position[1] = quantize_snorm16(position.y);
+			c.position[2] = quantize_snorm16(position.z);
+			c.position[3] = 0;
+
+			glm::vec2 normal = encode_octahedral(v.normal);
+			c.normal[0] = quantize_snorm16(normal.x);
+			c.normal[1] = quantize_snorm16(normal.y);
+
+			//colors past [0,1] would be clamped by the color attachment anyway
+			c.color[0] = quantize_unorm8(v.color.r);
+			c.color[1] = quantize_unorm8(v.color.g);
+			c.color[2] = quantize_unorm8(v.color.b);
+			c.color[3] = 255;
+		}
+
+		//the indices can still point into the mapped cache, only the vertex blob is let go
+		std::vector<Vertex>().swap(_vertices);
+		_mappedVertices = nullptr;
+		_mappedVertexCount = 0;
+		_format = VertexFormat::Compact;
+	}
+
+	//reorders the triangles for the vertex cache and overdraw, then the vertices for fetch, and reports the cache efficiency before and after.
+	//runs on freshly parsed meshes only, the binary cache stores the result
+	void optimize(const char* name) {
+		VertexCacheStats before = analyze_vertex_cache(_indices.data(), _indices.size(), _vertices.size());
+
+		std::vector<uint32_t> optimized;
+		std::vector<uint32_t> clusters;
+		optimize_vertex_cache(_indices.data(), _indices.size(), _vertices.size(), optimized, clusters);
+
+		std::vector<glm::vec3> positions(_vertices.size());
+		for (size_t i = 0; i < _vertices.size(); i++) {
+			positions[i] = _vertices[i].position;
+		}
+		optimize_overdraw(optimized, positions, clusters);
+		_indices.swap(optimized);
+
+		optimize_vertex_fetch(_vertices, _indices);
+
+		VertexCacheStats after = analyze_vertex_cache(_indices.data(), _indices.size(), _vertices.size());
+		std::cout << "Optimized " << name << ": ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+	}
+
+	//simplifies each level from the one before it and appends its indices, the bounds have to be computed already.
+	//stops early once a level can't get much smaller within MESH_LOD_MAX_ERROR
+	void build_lods(const char* name) {
+		_lods.clear();
+		_lods.push_back(MeshLod{ 0, (uint32_t)_indices.size(), 0.0f });
+
+		std::vector<glm::vec3> positions(_vertices.size());
+		for (size_t i = 0; i < _vertices.size(); i++) {
+			positions[i] = _vertices[i].position;
+		}
+		float meshSize = 2.0f * glm::max(_bounds.extents.x, glm::max(_bounds.extents.y, _bounds.extents.z));
+
+		std::vector<uint32_t> previous = _indices;
+		std::vector<uint32_t> optimized;
+		std::vector<uint32_t> clusters;
+		while (_lods.size() < MESH_MAX_LODS) {
+			float error;
+			std::vector<uint32_t> simplified = simplify_mesh(previous.data(), previous.size(), positions, previous.size() / 2, MESH_LOD_MAX_ERROR, &error);
+			if (simplified.empty() || simplified.size() > previous.size() * 9 / 10) {
+				break;
+			}
+			//each level is simplified from the last, so the errors add up
+			MeshLod lod;
+			lod.firstIndex = (uint32_t)_indices.size();
+			lod.indexCount = (uint32_t)simplified.size();
+			lod.error = _lods.back().error + error * meshSize;
+
+			optimize_vertex_cache(simplified.data(), simplified.size(), _vertices.size(), optimized, clusters);
+			_indices.insert(_indices.end(), optimized.begin(), optimized.end());
+			_lods.push_back(lod);
+			previous.swap(simplified);
+		}
+
+		std::cout << "Built " << _lods.size() << " levels of detail for " << name << ":";
+		for (const MeshLod& lod : _lods) {
+			std::cout << " " << lod.indexCount / 3;
+		}
+		std::cout << " triangles" << std::endl;
+	}
+
+	void build_meshlets(const char* name) {
+		std::vector<glm::vec3> positions(_vertices.size());
+		for (size_t i = 0; i < _vertices.size(); i++) {
+			positions[i] = _vertices[i].position;
+		}
+		MeshLod full = get_lod(0);
+		::build_meshlets(_indices.data() + full.firstIndex, full.indexCount, positions, _meshlets);
+		for (Meshlet& meshlet : _meshlets) {
+			meshlet.firstIndex += full.firstIndex;
+		}
+		std::cout << "Built " << _meshlets.size() << " meshlets for " << name << std::endl;
+	}
+
+	void compute_bounds() {
+		if (_vertices.empty()) {
+			_bounds = MeshBounds{};
+			return;
+		}
+		glm::vec3 minPos = _vertices[0].position;
+		glm::vec3 maxPos = _vertices[0].position;
+		for (const Vertex& v : _vertices) {
+			minPos = glm::min(minPos, v.position);
+			maxPos = glm::max(maxPos, v.position);
+		}
+		_bounds.origin = (minPos + maxPos) * 0.5f;
+		_bounds.extents = (maxPos - minPos) * 0.5f;
+
+		//the sphere is centered on the box, but sized to the actual vertices so it stays tight
+		float maxDist2 = 0.0f;
+		for (const Vertex& v : _vertices) {
+			glm::vec3 d = v.position - _bounds.origin;
+			maxDist2 = glm::max(maxDist2, glm::dot(d, d));
+		}
+		_bounds.radius = sqrtf(maxDist2);
+	}
+
+	//loads the mesh from the binary cache next to the obj if it is up to date, otherwise parses the obj and writes the cache.
+	//loads of the same file on different threads take turns, so only the first parses and the rest map what it wrote
+	bool load_from_file(const char* filename) {
+		std::string cachePath = get_cache_path(filename);
+		std::lock_guard<std::mutex> lock(get_cache_mutex(cachePath));
+
+		FileStamp sourceStamp;
+		bool haveSource = get_file_stamp(filename, sourceStamp);
+
+		if (load_from_cache(cachePath.c_str(), haveSource ? &sourceStamp : nullptr)) {
+			return true;
+		}
+
+		if (!load_from_obj(filename)) {
+			return false;
+		}
+		if (haveSource) {
+			save_to_cache(cachePath.c_str(), sourceStamp);
+		}
+		return true;
+	}
+
+	//one mutex per cache file, never freed so the reference stays valid
+	static std::mutex& get_cache_mutex(const std::string& cachePath) {
+		static std::mutex mapMutex;
+		static std::unordered_map<std::string, std::unique_ptr<std::mutex>> mutexes;
+		std::lock_guard<std::mutex> lock(mapMutex);
+		std::unique_ptr<std::mutex>& entry = mutexes[cachePath];
+		if (!entry) {
+			entry.reset(new std::mutex());
+		}
+		return *entry;
+	}
+
+	static std::string get_cache_path(const char* filename) {
+		std::string path = filename;
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+			path.resize(dot);
+		}
+		return path + ".mesh";
+	}
+
+	//the cache is written next to the real one and then moved over it, so a reader mapping it, or a crash halfway, never sees a torn file
+	bool save_to_cache(const char* cachePath, const FileStamp& sourceStamp) const {
+		std::string tempPath = std::string(cachePath) + ".tmp";
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cout << "WARN: could not write mesh cache " << cachePath << std::endl;
+			return false;
+		}
+
+		MeshFileHeader header{};
+		header.magic = MESH_FILE_MAGIC;
+		header.version = MESH_FILE_VERSION;
+		header.vertexStride = sizeof(Vertex);
+		header.vertexCount = (uint32_t)vertex_count();
+		header.indexCount = (uint32_t)index_count();
+		header.sourceSize = sourceStamp.size;
+		header.sourceTime = sourceStamp.modifiedTime;
+		memcpy(header.boundsOrigin, &_bounds.origin, sizeof(header.boundsOrigin));
+		header.boundsRadius = _bounds.radius;
+		memcpy(header.boundsExtents, &_bounds.extents, sizeof(header.boundsExtents));
+		header.vertexOffset = sizeof(MeshFileHeader);
+		header.indexOffset = header.vertexOffset + (uint64_t)header.vertexCount * sizeof(Vertex);
+		header.lodCount = (uint32_t)_lods.size();
+		header.lodOffset = header.indexOffset + (uint64_t)header.indexCount * sizeof(uint32_t);
+		header.meshletCount = (uint32_t)_meshlets.size();
+		header.meshletOffset = header.lodOffset + (uint64_t)header.lodCount * sizeof(MeshLod);
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)vertex_data(), (std::streamsize)(header.vertexCount * sizeof(Vertex)));
+		file.write((const char*)index_data(), (std::streamsize)(header.indexCount * sizeof(uint32_t)));
+		file.write((const char*)_lods.data(), (std::streamsize)(header.lodCount * sizeof(MeshLod)));
+		file.write((const char*)_meshlets.data(), (std::streamsize)(header.meshletCount * sizeof(Meshlet)));
+		file.close();
+		if (file.fail() || !replace_file(tempPath.c_str(), cachePath)) {
+			std::cout << "WARN: could not write mesh cache " << cachePath << std::endl;
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	//maps the cache file and points the mesh at its blobs, no per-vertex parsing happens here.
+	//sourceStamp is the stamp of the original obj, if the cache was built from a different file it is rejected.
+	bool load_from_cache(const char* cachePath, const FileStamp* sourceStamp) {
+		auto file = std::make_shared<MappedFile>();
+		if (!file->open(cachePath) || file->size() < sizeof(MeshFileHeader)) {
+			return false;
+		}
+
+		MeshFileHeader header;
+		memcpy(&header, file->data(), sizeof(header));
+		if (header.magic != MESH_FILE_MAGIC || header.version != MESH_FILE_VERSION || header.vertexStride != sizeof(Vertex)) {
+			return false;
+		}
+		if (sourceStamp && (header.sourceSize != sourceStamp->size || header.sourceTime != sourceStamp->modifiedTime)) {
+			return false;
+		}
+		uint64_t vertexBytes = (uint64_t)header.vertexCount * sizeof(Vertex);
+		uint64_t indexBytes = (uint64_t)header.indexCount * sizeof(uint32_t);
+		uint64_t lodBytes = (uint64_t)header.lodCount * sizeof(MeshLod);
+		uint64_t meshletBytes = (uint64_t)header.meshletCount * sizeof(Meshlet);
+		if (header.vertexOffset + vertexBytes > file->size() || header.indexOffset + indexBytes > file->size() || header.lodOffset + lodBytes > file->size()
+			|| header.meshletOffset + meshletBytes > file->size()) {
+			return false;
+		}
+
+		const char* base = (const char*)file->data();
+		//the table is tiny, copied so it lives as long as the mesh rather than the mapping
+		std::vector<MeshLod> lods(header.lodCount);
+		memcpy(lods.data(), base + header.lodOffset, (size_t)lodBytes);
+		for (const MeshLod& lod : lods) {
+			if ((uint64_t)lod.firstIndex + lod.indexCount > header.indexCount) {
+				return false;
+			}
+		}
+		//meshlets are drawn as ranges of the index list, so they get the same check
+		std::vector<Meshlet> meshlets(header.meshletCount);
+		memcpy(meshlets.data(), base + header.meshletOffset, (size_t)meshletBytes);
+		for (const Meshlet& meshlet : meshlets) {
+			if ((uint64_t)meshlet.firstIndex + meshlet.indexCount > header.indexCount) {
+				return false;
+			}
+		}
+
+		_mappedVertices = (const Vertex*)(base + header.vertexOffset);
+		_mappedIndices = (const uint32_t*)(base + header.indexOffset);
+		_mappedVertexCount = header.vertexCount;
+		_mappedIndexCount = header.indexCount;
+		memcpy(&_bounds.origin, header.boundsOrigin, sizeof(header.boundsOrigin));
+		_bounds.radius = header.boundsRadius;
+		memcpy(&_bounds.extents, header.boundsExtents, sizeof(header.boundsExtents));
+		_lods.swap(lods);
+		_meshlets.swap(meshlets);
+		_mappedFile = file;
+		return true;
+	}
+
 	bool load_from_obj(const char* filename) {
 		//attrib will contain the verte arrays of the file
 		tinyobj::attrib_t attrib;
@@ -84,6 +587,9 @@ struct Mesh {
 			return false;
 		}
 
+		//unique vertex table, so shared corners are stored and shaded once
+		std::unordered_map<Vertex, uint32_t> uniqueVertices;
+
 		//Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 			//Loop over faces (polygons)
@@ -115,12 +621,29 @@ struct Mesh {
 					newVert.normal.z = nz;
 					newVert.color = newVert.normal;
 
-					_vertices.push_back(newVert);
+					//reuse the vertex if we have already seen this exact tuple
+					auto it = uniqueVertices.find(newVert);
+					if (it == uniqueVertices.end()) {
+						uint32_t newIndex = static_cast<uint32_t>(_vertices.size());
+						uniqueVertices[newVert] = newIndex;
+						_vertices.push_back(newVert);
+						_indices.push_back(newIndex);
+					}
+					else {
+						_indices.push_back(it->second);
+					}
 				}
 				index_offset += fv;
 			}
 		}
 
+		optimize(filename);
+		compute_bounds();
+		build_lods(filename);
+		build_meshlets(filename);
+
+		std::cout << "Loaded " << filename << ": " << _indices.size() << " indices, " << _vertices.size() << " unique vertices" << std::endl;
+
 		return true;
 	}
 };
@@ -0,0 +1,127 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include "vk_culling.h"
+
+//Meshlets split a mesh's full detail index list into small clusters that can be culled on their own.
+//They're built over runs of consecutive triangles, so each one is a plain range of the index list that's already in the shared
+//index buffer, and the cache and overdraw ordering is kept. The vertex limit is about cluster size and reuse, not a hardware limit here.
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+//stored as is in the binary mesh cache
+struct Meshlet {
+	glm::vec3	center;		//bounding sphere, mesh space
+	float		radius;
+	glm::vec3	coneAxis;	//average facing of the triangles
+	float		coneCutoff;	//sine of the widest angle between a triangle and the axis, 1 when the cluster can face every way
+	uint32_t	firstIndex;	//range of the mesh's index list
+	uint32_t	indexCount;
+	uint32_t	vertexCount;
+	uint32_t	padding;
+};
+
+//fills in the bounding sphere and normal cone of a meshlet from its triangles
+inline void compute_meshlet_bounds(Meshlet& meshlet, const uint32_t* indices, const std::vector<glm::vec3>& positions) {
+	const uint32_t* first = indices + meshlet.firstIndex;
+
+	glm::vec3 minPos = positions[first[0]];
+	glm::vec3 maxPos = minPos;
+	for (uint32_t i = 0; i < meshlet.indexCount; i++) {
+		minPos = glm::min(minPos, positions[first[i]]);
+		maxPos = glm::max(maxPos, positions[first[i]]);
+	}
+	meshlet.center = (minPos + maxPos) * 0.5f;
+	float maxDist2 = 0.0f;
+	for (uint32_t i = 0; i < meshlet.indexCount; i++) {
+		glm::vec3 d = positions[first[i]] - meshlet.center;
+		maxDist2 = glm::max(maxDist2, glm::dot(d, d));
+	}
+	meshlet.radius = sqrtf(maxDist2);
+
+	//the cone is only useful if every triangle faces within 90 degrees of the axis
+	glm::vec3 normals[MESHLET_MAX_TRIANGLES];
+	uint32_t normalCount = 0;
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i + 2 < meshlet.indexCount; i += 3) {
+		const glm::vec3& p0 = positions[first[i + 0]];
+		const glm::vec3& p1 = positions[first[i + 1]];
+		const glm::vec3& p2 = positions[first[i + 2]];
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(n);
+		if (length == 0.0f) {
+			continue;
+		}
+		normals[normalCount++] = n / length;
+		axis += n / length;
+	}
+	meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneCutoff = 1.0f;
+	float axisLength = glm::length(axis);
+	if (normalCount == 0 || axisLength == 0.0f) {
+		return;
+	}
+	axis /= axisLength;
+	float minDot = 1.0f;
+	for (uint32_t i = 0; i < normalCount; i++) {
+		minDot = glm::min(minDot, glm::dot(normals[i], axis));
+	}
+	meshlet.coneAxis = axis;
+	if (minDot > 0.0f) {
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+}
+
+//splits the triangle list into meshlets, starting a new one whenever the next triangle would go over either limit
+inline void build_meshlets(const uint32_t* indices, size_t indexCount, const std::vector<glm::vec3>& positions, std::vector<Meshlet>& meshlets) {
+	meshlets.clear();
+	//vertices already in the current meshlet are marked with its number
+	std::vector<uint32_t> marker(positions.size(), ~0u);
+
+	Meshlet current{};
+	uint32_t meshletId = 0;
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++) {
+			newVertices += marker[indices[i + k]] != meshletId ? 1 : 0;
+		}
+		//corners that repeat inside the triangle were counted twice, which can only end a meshlet a triangle early
+		if (current.indexCount > 0 && (current.vertexCount + newVertices > MESHLET_MAX_VERTICES || current.indexCount / 3 + 1 > MESHLET_MAX_TRIANGLES)) {
+			compute_meshlet_bounds(current, indices, positions);
+			meshlets.push_back(current);
+			current = Meshlet{};
+			current.firstIndex = (uint32_t)i;
+			meshletId++;
+		}
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = indices[i + k];
+			if (marker[v] != meshletId) {
+				marker[v] = meshletId;
+				current.vertexCount++;
+			}
+		}
+		current.indexCount += 3;
+	}
+	if (current.indexCount > 0) {
+		compute_meshlet_bounds(current, indices, positions);
+		meshlets.push_back(current);
+	}
+}
+
+//true when the meshlet can't be seen: its sphere is outside the frustum, or (with coneCulling) all of its triangles face away from the camera.
+//localCamera is the camera position in the mesh's space, where facing doesn't depend on how the object is scaled or mirrored
+inline bool cull_meshlet(const Meshlet& meshlet, const glm::mat4& model, const glm::vec3& localCamera, const Frustum& frustum, bool coneCulling) {
+	if (coneCulling) {
+		glm::vec3 d = meshlet.center - localCamera;
+		if (glm::dot(d, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(d) + meshlet.radius) {
+			return true;
+		}
+	}
+	glm::vec3 center;
+	float radius;
+	transform_sphere(model, meshlet.center, meshlet.radius, center, radius);
+	return !sphere_in_frustum(frustum, center.x, center.y, center.z, radius);
+}
@@ -0,0 +1,264 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+//Load time reordering of indexed triangle lists, run on meshes parsed from obj before they're written to the binary cache.
+//Triangles are reordered for the post-transform vertex cache (Tipsify, Sander et al. 2007), then clusters of them are sorted
+//so outward facing ones are drawn first and hide the rest (view independent overdraw, from the same paper),
+//and finally vertices are renumbered in the order the index buffer first uses them so fetches walk memory forward.
+
+//vertex cache size the reordering targets and the stats are measured with, a conservative guess at a post-transform FIFO
+constexpr uint32_t MESH_OPT_CACHE_SIZE = 16;
+//clusters are split where their own cache efficiency is already within this factor of the whole cluster's, more clusters sort overdraw better
+constexpr float MESH_OPT_OVERDRAW_THRESHOLD = 1.05f;
+
+//ACMR is vertices transformed per triangle (0.5 is ideal on a regular grid, 3 is no reuse at all),
+//ATVR is vertices transformed per vertex referenced (1 is ideal)
+struct VertexCacheStats {
+	float	acmr;
+	float	atvr;
+};
+
+//simulates a FIFO vertex cache over the index list
+inline VertexCacheStats analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = MESH_OPT_CACHE_SIZE) {
+	VertexCacheStats stats = { 0.0f, 0.0f };
+	if (indexCount < 3) {
+		return stats;
+	}
+	//a vertex is in the cache if it was last transformed less than cacheSize transforms ago
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<uint8_t> referenced(vertexCount, 0);
+	uint32_t time = cacheSize + 1;
+	size_t transformed = 0;
+	size_t unique = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t v = indices[i];
+		if (time - cacheTime[v] > cacheSize) {
+			cacheTime[v] = time++;
+			transformed++;
+		}
+		if (!referenced[v]) {
+			referenced[v] = 1;
+			unique++;
+		}
+	}
+	stats.acmr = (float)transformed / (float)(indexCount / 3);
+	stats.atvr = (float)transformed / (float)unique;
+	return stats;
+}
+
+//Tipsify: fans around one vertex at a time, moving to the neighbour that is still in the cache and has the fewest triangles left.
+//clusters gets the first triangle of every run that started from a dead end, those are where the cache is cold and are safe to reorder
+inline void optimize_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& destination, std::vector<uint32_t>& clusters, uint32_t cacheSize = MESH_OPT_CACHE_SIZE) {
+	const size_t triangleCount = indexCount / 3;
+	destination.clear();
+	destination.reserve(triangleCount * 3);
+	clusters.clear();
+
+	//triangles using each vertex, as offsets into one flat list
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		liveTriangles[indices[i]]++;
+	}
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+	}
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) {
+			adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+		}
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	uint32_t time = cacheSize + 1;
+	size_t cursor = 0;
+
+	//next vertex with triangles left when the fan has nowhere to go: a recently used one off the dead end stack, else the next in order
+	auto skip_dead_end = [&]() -> int64_t {
+		while (!deadEnd.empty()) {
+			uint32_t v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[v] > 0) {
+				return v;
+			}
+		}
+		while (cursor < vertexCount) {
+			if (liveTriangles[cursor] > 0) {
+				return (int64_t)cursor;
+			}
+			cursor++;
+		}
+		return -1;
+	};
+
+	int64_t fanVertex = skip_dead_end();
+	bool coldStart = true;
+	while (fanVertex >= 0) {
+		if (coldStart) {
+			clusters.push_back((uint32_t)(destination.size() / 3));
+		}
+
+		candidates.clear();
+		uint32_t f = (uint32_t)fanVertex;
+		for (uint32_t a = adjacencyOffsets[f]; a < adjacencyOffsets[f + 1]; a++) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			emitted[t] = 1;
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				destination.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > cacheSize) {
+					cacheTime[v] = time++;
+				}
+			}
+		}
+
+		//only a candidate that will still be in the cache after its remaining triangles are emitted can continue the fan, oldest first
+		int64_t best = -1;
+		int64_t bestPriority = 0;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0) {
+				continue;
+			}
+			int64_t priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+				priority = time - cacheTime[v];
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = v;
+			}
+		}
+		coldStart = best < 0;
+		fanVertex = coldStart ? skip_dead_end() : best;
+	}
+}
+
+//splits the cache optimized clusters further wherever the triangles so far already reuse the cache about as well as the whole cluster,
+//then sorts the clusters front to back by how far they face out from the mesh center, so they tend to occlude each other from any view
+inline void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& hardClusters, uint32_t cacheSize = MESH_OPT_CACHE_SIZE, float threshold = MESH_OPT_OVERDRAW_THRESHOLD) {
+	const uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+	if (triangleCount == 0 || hardClusters.empty()) {
+		return;
+	}
+
+	std::vector<uint32_t> cacheTime(positions.size(), 0);
+	uint32_t time = cacheSize + 1;
+	//cache misses of triangles [first, last) with a cold cache
+	auto count_misses = [&](uint32_t first, uint32_t last, std::vector<uint32_t>* boundaries, float splitAcmr) -> uint32_t {
+		time += cacheSize + 1;
+		uint32_t misses = 0;
+		uint32_t start = first;
+		for (uint32_t t = first; t < last; t++) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				if (time - cacheTime[v] > cacheSize) {
+					cacheTime[v] = time++;
+					misses++;
+				}
+			}
+			if (boundaries && t + 1 < last && (float)misses / (float)(t + 1 - start) <= splitAcmr) {
+				boundaries->push_back(t + 1);
+				time += cacheSize + 1;
+				misses = 0;
+				start = t + 1;
+			}
+		}
+		return misses;
+	};
+
+	std::vector<uint32_t> clusters;
+	for (size_t c = 0; c < hardClusters.size(); c++) {
+		uint32_t first = hardClusters[c];
+		uint32_t last = c + 1 < hardClusters.size() ? hardClusters[c + 1] : triangleCount;
+		float acmr = (float)count_misses(first, last, nullptr, 0.0f) / (float)(last - first);
+		clusters.push_back(first);
+		count_misses(first, last, &clusters, acmr * threshold);
+	}
+
+	//area weighted centroid and normal of every cluster, and the centroid of the whole mesh
+	struct ClusterSort {
+		float		key;
+		uint32_t	first;
+		uint32_t	last;
+	};
+	std::vector<ClusterSort> order(clusters.size());
+	std::vector<glm::vec3> centroids(clusters.size());
+	std::vector<glm::vec3> normals(clusters.size());
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusters.size(); c++) {
+		uint32_t first = clusters[c];
+		uint32_t last = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for (uint32_t t = first; t < last; t++) {
+			const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+			const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+			//the cross product's length is twice the area, which weights both sums the same
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			centroid += (p0 + p1 + p2) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+		meshCentroid += centroid;
+		meshArea += area;
+		centroids[c] = area > 0.0f ? centroid / area : positions[indices[first * 3]];
+		float normalLength = glm::length(normal);
+		normals[c] = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f);
+		order[c].first = first;
+		order[c].last = last;
+	}
+	if (meshArea > 0.0f) {
+		meshCentroid /= meshArea;
+	}
+	for (size_t c = 0; c < clusters.size(); c++) {
+		order[c].key = glm::dot(centroids[c] - meshCentroid, normals[c]);
+	}
+
+	//most outward facing first
+	std::stable_sort(order.begin(), order.end(), [](const ClusterSort& a, const ClusterSort& b) {
+		return a.key > b.key;
+		});
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for (const ClusterSort& cluster : order) {
+		sorted.insert(sorted.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.last * 3);
+	}
+	indices.swap(sorted);
+}
+
+//renumbers the vertices in the order the index list first references them, vertices nothing references are dropped
+template<typename V>
+inline void optimize_vertex_fetch(std::vector<V>& vertices, std::vector<uint32_t>& indices) {
+	const uint32_t unused = ~0u;
+	std::vector<uint32_t> remap(vertices.size(), unused);
+	std::vector<V> reordered;
+	reordered.reserve(vertices.size());
+	for (uint32_t& index : indices) {
+		if (remap[index] == unused) {
+			remap[index] = (uint32_t)reordered.size();
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices.swap(reordered);
+}
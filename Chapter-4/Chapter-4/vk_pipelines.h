@@ -0,0 +1,365 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include "vk_types.h"
+#include "vk_jobs.h"
+#include <cstring>
+#include <cstdint>
+
+//flattened copy of every piece of state that goes into a graphics pipeline, used as the pipeline cache key.
+//fields are appended one by one rather than copying whole structs, so padding and pNext pointers never leak into it
+struct PipelineKey {
+	std::vector<uint32_t>	words;
+	size_t					hash = 0;
+
+	void add(uint32_t value) {
+		words.push_back(value);
+	}
+
+	void add_float(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		words.push_back(bits);
+	}
+
+	void add_u64(uint64_t value) {
+		words.push_back((uint32_t)value);
+		words.push_back((uint32_t)(value >> 32));
+	}
+
+	//non-dispatchable handles are pointers on 64 bit and uint64_t on 32 bit builds, both cast cleanly
+	template<typename T>
+	void add_handle(T handle) {
+		add_u64((uint64_t)handle);
+	}
+
+	void add_string(const char* str) {
+		size_t length = str ? strlen(str) : 0;
+		add((uint32_t)length);
+		for (size_t i = 0; i < length; i++) {
+			add((uint32_t)(uint8_t)str[i]);
+		}
+	}
+
+	void add_stencil(const VkStencilOpState& op) {
+		add(op.failOp);
+		add(op.passOp);
+		add(op.depthFailOp);
+		add(op.compareOp);
+		add(op.compareMask);
+		add(op.writeMask);
+		add(op.reference);
+	}
+
+	//FNV-1a over the words, called once the key is complete
+	void finish() {
+		uint64_t h = 14695981039346656037ull;
+		for (uint32_t w : words) {
+			h ^= w;
+			h *= 1099511628211ull;
+		}
+		hash = (size_t)h;
+	}
+
+	bool operator==(const PipelineKey& other) const {
+		return hash == other.hash && words == other.words;
+	}
+};
+
+struct PipelineBuilder {
+	std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
+	std::vector<uint64_t> _shaderHashes;	//content hash of each stage's module, keyed instead of the handle when present
+	VkPipelineVertexInputStateCreateInfo _vertexInputInfo;
+	VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
+	VkViewport _viewport;
+	VkRect2D _scissor;
+	VkPipelineRasterizationStateCreateInfo _rasterizer;
+	VkPipelineColorBlendAttachmentState _colorBlendAttachment;
+	VkPipelineMultisampleStateCreateInfo _multiSampling;
+	VkPipelineLayout _pipelineLayout;
+	VkPipelineDepthStencilStateCreateInfo _depthStencil;
+
+	VkPipeline build_pipeline(VkDevice device, VkRenderPass renderPass, VkPipelineCache pipelineCache) {
+		//make viewport state from our stored viewport and scissor.
+		//at the moment we won't support multiple viewports and scissors
+		VkPipelineViewportStateCreateInfo viewportState{};
+		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportState.viewportCount = 1;
+		viewportState.pViewports = &_viewport;
+		viewportState.scissorCount = 1;
+		viewportState.pScissors = &_scissor;
+
+		//Setup dummy color blending. We aren't using transparent objects yet.
+		//The blending is just "no blend", but we do write to the color attachment.
+		VkPipelineColorBlendStateCreateInfo colorBlending{};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+		colorBlending.logicOpEnable = VK_FALSE;
+		colorBlending.logicOp = VK_LOGIC_OP_COPY;
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments = &_colorBlendAttachment;
+
+		//Build the actual pipeline.
+		//We now use all of the info structs we have been writing into this one to create the pipeline.
+		VkGraphicsPipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = static_cast<uint32_t> (_shaderStages.size());
+		pipelineInfo.pStages = _shaderStages.data();
+		pipelineInfo.pVertexInputState = &_vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &_inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &_rasterizer;
+		pipelineInfo.pMultisampleState = &_multiSampling;
+		pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.layout = _pipelineLayout;
+		pipelineInfo.pDepthStencilState = &_depthStencil;
+		pipelineInfo.renderPass = renderPass;
+		pipelineInfo.subpass = 0;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+		//It's easy to error out on create graphics pipeline, so we handle it a bit better than the common VK_CHECK case.
+		VkPipeline newPipeline = VK_NULL_HANDLE;
+		if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
+			std::cout << "failed to create pipeline" << std::endl;
+			return VK_NULL_HANDLE;
+		}
+		return newPipeline;
+	}
+
+	//everything build_pipeline() would read, including the vertex input arrays the create info points at
+	PipelineKey make_key(VkRenderPass renderPass) const {
+		PipelineKey key;
+		key.add_handle(renderPass);
+		key.add_handle(_pipelineLayout);
+
+		//module handles only identify the code while the module is alive, a content hash stays valid after the module is freed
+		//and its handle reused. The tag word keeps a hash from ever matching a handle
+		key.add((uint32_t)_shaderStages.size());
+		for (size_t s = 0; s < _shaderStages.size(); s++) {
+			const VkPipelineShaderStageCreateInfo& stage = _shaderStages[s];
+			key.add(stage.stage);
+			if (s < _shaderHashes.size()) {
+				key.add(1);
+				key.add_u64(_shaderHashes[s]);
+			}
+			else {
+				key.add(0);
+				key.add_handle(stage.module);
+			}
+			key.add_string(stage.pName);
+			const VkSpecializationInfo* spec = stage.pSpecializationInfo;
+			key.add(spec ? spec->mapEntryCount : 0);
+			if (spec) {
+				for (uint32_t i = 0; i < spec->mapEntryCount; i++) {
+					key.add(spec->pMapEntries[i].constantID);
+					key.add(spec->pMapEntries[i].offset);
+					key.add((uint32_t)spec->pMapEntries[i].size);
+				}
+				key.add((uint32_t)spec->dataSize);
+				for (size_t i = 0; i < spec->dataSize; i++) {
+					key.add(((const uint8_t*)spec->pData)[i]);
+				}
+			}
+		}
+
+		key.add(_vertexInputInfo.vertexBindingDescriptionCount);
+		for (uint32_t i = 0; i < _vertexInputInfo.vertexBindingDescriptionCount; i++) {
+			const VkVertexInputBindingDescription& binding = _vertexInputInfo.pVertexBindingDescriptions[i];
+			key.add(binding.binding);
+			key.add(binding.stride);
+			key.add(binding.inputRate);
+		}
+		key.add(_vertexInputInfo.vertexAttributeDescriptionCount);
+		for (uint32_t i = 0; i < _vertexInputInfo.vertexAttributeDescriptionCount; i++) {
+			const VkVertexInputAttributeDescription& attribute = _vertexInputInfo.pVertexAttributeDescriptions[i];
+			key.add(attribute.location);
+			key.add(attribute.binding);
+			key.add(attribute.format);
+			key.add(attribute.offset);
+		}
+
+		key.add(_inputAssembly.topology);
+		key.add(_inputAssembly.primitiveRestartEnable);
+
+		key.add_float(_viewport.x);
+		key.add_float(_viewport.y);
+		key.add_float(_viewport.width);
+		key.add_float(_viewport.height);
+		key.add_float(_viewport.minDepth);
+		key.add_float(_viewport.maxDepth);
+		key.add((uint32_t)_scissor.offset.x);
+		key.add((uint32_t)_scissor.offset.y);
+		key.add(_scissor.extent.width);
+		key.add(_scissor.extent.height);
+
+		key.add(_rasterizer.depthClampEnable);
+		key.add(_rasterizer.rasterizerDiscardEnable);
+		key.add(_rasterizer.polygonMode);
+		key.add(_rasterizer.cullMode);
+		key.add(_rasterizer.frontFace);
+		key.add(_rasterizer.depthBiasEnable);
+		key.add_float(_rasterizer.depthBiasConstantFactor);
+		key.add_float(_rasterizer.depthBiasClamp);
+		key.add_float(_rasterizer.depthBiasSlopeFactor);
+		key.add_float(_rasterizer.lineWidth);
+
+		key.add(_colorBlendAttachment.blendEnable);
+		key.add(_colorBlendAttachment.srcColorBlendFactor);
+		key.add(_colorBlendAttachment.dstColorBlendFactor);
+		key.add(_colorBlendAttachment.colorBlendOp);
+		key.add(_colorBlendAttachment.srcAlphaBlendFactor);
+		key.add(_colorBlendAttachment.dstAlphaBlendFactor);
+		key.add(_colorBlendAttachment.alphaBlendOp);
+		key.add(_colorBlendAttachment.colorWriteMask);
+
+		key.add(_multiSampling.rasterizationSamples);
+		key.add(_multiSampling.sampleShadingEnable);
+		key.add_float(_multiSampling.minSampleShading);
+		key.add(_multiSampling.pSampleMask ? _multiSampling.pSampleMask[0] : 0xffffffff);
+		key.add(_multiSampling.alphaToCoverageEnable);
+		key.add(_multiSampling.alphaToOneEnable);
+
+		key.add(_depthStencil.depthTestEnable);
+		key.add(_depthStencil.depthWriteEnable);
+		key.add(_depthStencil.depthCompareOp);
+		key.add(_depthStencil.depthBoundsTestEnable);
+		key.add(_depthStencil.stencilTestEnable);
+		key.add_stencil(_depthStencil.front);
+		key.add_stencil(_depthStencil.back);
+		key.add_float(_depthStencil.minDepthBounds);
+		key.add_float(_depthStencil.maxDepthBounds);
+
+		key.finish();
+		return key;
+	}
+};
+
+//Returns an existing VkPipeline when a builder with identical state was already built, and builds and keeps it otherwise.
+//The cache owns every pipeline it hands out. Shader stages are part of the key by the content hash in _shaderHashes,
+//so their modules can be released as soon as the build is done. A builder without hashes is keyed by module handle instead,
+//and its modules have to stay alive for as long as the pipelines built from them are in the cache, or a new module could reuse the handle.
+class PipelineStateCache {
+public:
+	struct Stats {
+		uint32_t	hits;
+		uint32_t	misses;		//new pipelines compiled
+		uint32_t	failures;	//failed builds are not cached, so a fixed shader can be retried
+	};
+
+	void init(VkDevice device, VkPipelineCache pipelineCache) {
+		_device = device;
+		_pipelineCache = pipelineCache;
+	}
+
+	void cleanup() {
+		for (auto& entry : _pipelines) {
+			vkDestroyPipeline(_device, entry.second, nullptr);
+		}
+		_pipelines.clear();
+	}
+
+	VkPipeline get_pipeline(PipelineBuilder& builder, VkRenderPass renderPass) {
+		PipelineKey key = builder.make_key(renderPass);
+
+		auto it = _pipelines.find(key);
+		if (it != _pipelines.end()) {
+			_stats.hits++;
+			return it->second;
+		}
+
+		VkPipeline pipeline = builder.build_pipeline(_device, renderPass, _pipelineCache);
+		if (pipeline == VK_NULL_HANDLE) {
+			_stats.failures++;
+			return VK_NULL_HANDLE;
+		}
+		_stats.misses++;
+		_pipelines.emplace(std::move(key), pipeline);
+		return pipeline;
+	}
+
+	//resolves a whole batch of builders, compiling the missing pipelines in parallel on the job system.
+	//outPipelines[i] is the pipeline for builders[i], or VK_NULL_HANDLE if it failed to build.
+	//builders that are already cached, or repeated within the batch, are only built once.
+	//the lookups and inserts happen on the calling thread, the workers only call vkCreateGraphicsPipelines,
+	//which is safe to run concurrently and shares the driver pipeline cache (that one is internally synchronized)
+	void get_pipelines(std::vector<PipelineBuilder>& builders, VkRenderPass renderPass, JobSystem& jobSystem, std::vector<VkPipeline>& outPipelines) {
+		const size_t count = builders.size();
+		outPipelines.assign(count, VK_NULL_HANDLE);
+
+		std::vector<PipelineKey> keys(count);
+		std::vector<size_t> toBuild;		//builder index of each unique missing pipeline
+		std::vector<size_t> buildSlot(count, SIZE_MAX);	//which toBuild entry a missing builder waits on
+		std::unordered_map<PipelineKey, size_t, PipelineKeyHash> pending;
+
+		for (size_t i = 0; i < count; i++) {
+			keys[i] = builders[i].make_key(renderPass);
+
+			auto it = _pipelines.find(keys[i]);
+			if (it != _pipelines.end()) {
+				_stats.hits++;
+				outPipelines[i] = it->second;
+				continue;
+			}
+
+			auto pendingIt = pending.find(keys[i]);
+			if (pendingIt != pending.end()) {
+				_stats.hits++;
+				buildSlot[i] = pendingIt->second;
+				continue;
+			}
+
+			buildSlot[i] = toBuild.size();
+			pending.emplace(keys[i], toBuild.size());
+			toBuild.push_back(i);
+		}
+
+		std::vector<VkPipeline> built(toBuild.size(), VK_NULL_HANDLE);
+		jobSystem.parallel_for((uint32_t)toBuild.size(), [&](uint32_t job) {
+			built[job] = builders[toBuild[job]].build_pipeline(_device, renderPass, _pipelineCache);
+			});
+
+		for (size_t job = 0; job < toBuild.size(); job++) {
+			if (built[job] == VK_NULL_HANDLE) {
+				_stats.failures++;
+				continue;
+			}
+			_stats.misses++;
+			_pipelines.emplace(keys[toBuild[job]], built[job]);
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			if (buildSlot[i] != SIZE_MAX) {
+				outPipelines[i] = built[buildSlot[i]];
+			}
+		}
+	}
+
+	//forgets a cached pipeline without destroying it, for when the caller retires it itself (hot reload defers the destroy until no frame uses it)
+	bool remove(VkPipeline pipeline) {
+		for (auto it = _pipelines.begin(); it != _pipelines.end(); ++it) {
+			if (it->second == pipeline) {
+				_pipelines.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	Stats get_stats() const {
+		return _stats;
+	}
+
+	size_t pipeline_count() const {
+		return _pipelines.size();
+	}
+private:
+	struct PipelineKeyHash {
+		size_t operator()(const PipelineKey& k) const {
+			return k.hash;
+		}
+	};
+
+	VkDevice			_device = VK_NULL_HANDLE;
+	VkPipelineCache		_pipelineCache = VK_NULL_HANDLE;
+	Stats				_stats = {};
+	std::unordered_map<PipelineKey, VkPipeline, PipelineKeyHash>	_pipelines;
+};
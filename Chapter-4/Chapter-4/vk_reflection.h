@@ -0,0 +1,433 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include "vk_types.h"
+#include <cstdint>
+#include <algorithm>
+
+//Reads the descriptor bindings and push constant block of a SPIR-V module straight from its words.
+//Reflect every stage of a program into the same object and the results are merged: bindings that appear in
+//several stages get their stage flags OR'd together, and a binding declared with two different types is an error.
+//Buffers come out as plain UNIFORM_BUFFER / STORAGE_BUFFER, whether one is bound dynamic is up to whoever writes it.
+class ShaderReflection {
+public:
+	struct Binding {
+		uint32_t			set;
+		uint32_t			binding;
+		VkDescriptorType	type;
+		uint32_t			count;
+		VkShaderStageFlags	stages;
+	};
+
+	//adds one module to the reflection. False if the words aren't valid spirv or disagree with what was reflected before
+	bool reflect(const uint32_t* code, size_t wordCount) {
+		//every id is defined by an instruction of at least two words, so a bound past the word count means a corrupt file
+		if (wordCount < 5 || code[0] != SPIRV_MAGIC || code[3] > wordCount) {
+			return false;
+		}
+
+		//everything the reflection needs to know about one result id, filled in by whichever instructions mention it.
+		//decorations come before the types and variables they decorate, so nothing here depends on instruction order
+		std::vector<IdInfo> ids(code[3]);
+		VkShaderStageFlags stages = 0;
+
+		for (size_t offset = 5; offset < wordCount;) {
+			const uint32_t* ins = code + offset;
+			uint32_t opcode = ins[0] & 0xffff;
+			uint32_t length = ins[0] >> 16;
+			if (length == 0 || offset + length > wordCount) {
+				return false;
+			}
+			offset += length;
+
+			switch (opcode) {
+			case OpEntryPoint:
+				if (length < 2) {
+					return false;
+				}
+				stages |= stage_from_execution_model(ins[1]);
+				break;
+			case OpDecorate:
+				//every decoration read here except Block and BufferBlock carries one literal
+				if (length < 3 || ins[1] >= ids.size() || (length < 4 && ins[2] != DecorationBlock && ins[2] != DecorationBufferBlock)) {
+					return false;
+				}
+				switch (ins[2]) {
+				case DecorationBlock:		ids[ins[1]].block = true; break;
+				case DecorationBufferBlock:	ids[ins[1]].bufferBlock = true; break;
+				case DecorationArrayStride:	ids[ins[1]].arrayStride = ins[3]; break;
+				case DecorationBinding:		ids[ins[1]].binding = ins[3]; break;
+				case DecorationDescriptorSet:	ids[ins[1]].set = ins[3]; break;
+				}
+				break;
+			case OpMemberDecorate:
+				if (length < 4 || ins[1] >= ids.size() || ins[2] >= wordCount) {
+					return false;
+				}
+				if ((ins[3] == DecorationOffset || ins[3] == DecorationMatrixStride) && length >= 5) {
+					IdInfo& info = ids[ins[1]];
+					if (info.memberOffsets.size() <= ins[2]) {
+						info.memberOffsets.resize(ins[2] + 1, 0);
+						info.memberMatrixStrides.resize(ins[2] + 1, 0);
+					}
+					(ins[3] == DecorationOffset ? info.memberOffsets : info.memberMatrixStrides)[ins[2]] = ins[4];
+				}
+				break;
+			case OpTypeInt:
+			case OpTypeFloat:
+			case OpTypeVector:
+			case OpTypeMatrix:
+			case OpTypeImage:
+			case OpTypeSampler:
+			case OpTypeSampledImage:
+			case OpTypeArray:
+			case OpTypeRuntimeArray:
+			case OpTypeStruct:
+			case OpTypePointer:
+			case OpConstant:
+			case OpVariable:
+				if (!read_definition(opcode, ins, length, ids)) {
+					return false;
+				}
+				break;
+			}
+		}
+
+		_stages |= stages;
+
+		for (const IdInfo& variable : ids) {
+			if (variable.opcode != OpVariable) {
+				continue;
+			}
+
+			if (variable.storageClass == StorageClassPushConstant) {
+				uint32_t size = type_size(ids, ids[variable.typeId].typeId, 0, 0);
+				_pushConstantSize = std::max(_pushConstantSize, size);
+				_pushConstantStages |= stages;
+				continue;
+			}
+
+			if (variable.storageClass != StorageClassUniformConstant && variable.storageClass != StorageClassUniform && variable.storageClass != StorageClassStorageBuffer) {
+				continue;
+			}
+			if (variable.set == UNDECORATED || variable.binding == UNDECORATED) {
+				continue;
+			}
+
+			//unwrap arrays of descriptors, a runtime array is counted as one
+			uint32_t typeId = ids[variable.typeId].typeId;
+			uint32_t count = 1;
+			for (int depth = 0; depth < MAX_TYPE_DEPTH && (ids[typeId].opcode == OpTypeArray || ids[typeId].opcode == OpTypeRuntimeArray); depth++) {
+				if (ids[typeId].opcode == OpTypeArray) {
+					count *= ids[ids[typeId].lengthId].value;
+				}
+				typeId = ids[typeId].typeId;
+			}
+
+			VkDescriptorType type;
+			if (!descriptor_type(ids, typeId, variable.storageClass, type)) {
+				continue;	//something this engine doesn't bind, like an acceleration structure
+			}
+
+			if (!add_binding({ variable.set, variable.binding, type, count, stages })) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//folds another reflection into this one, the same way reflect() folds in a module
+	bool merge(const ShaderReflection& other) {
+		for (const Binding& binding : other._bindings) {
+			if (!add_binding(binding)) {
+				return false;
+			}
+		}
+		_pushConstantSize = std::max(_pushConstantSize, other._pushConstantSize);
+		_pushConstantStages |= other._pushConstantStages;
+		_stages |= other._stages;
+		return true;
+	}
+
+	const std::vector<Binding>& get_bindings() const {
+		return _bindings;
+	}
+
+	//bindings of one set, ready for a VkDescriptorSetLayoutCreateInfo
+	std::vector<VkDescriptorSetLayoutBinding> get_set_bindings(uint32_t set) const {
+		std::vector<VkDescriptorSetLayoutBinding> result;
+		for (const Binding& b : _bindings) {
+			if (b.set == set) {
+				VkDescriptorSetLayoutBinding layoutBinding{};
+				layoutBinding.binding = b.binding;
+				layoutBinding.descriptorType = b.type;
+				layoutBinding.descriptorCount = b.count;
+				layoutBinding.stageFlags = b.stages;
+				result.push_back(layoutBinding);
+			}
+		}
+		return result;
+	}
+
+	//one range covering the whole block, for every stage that declares it. False if no stage has push constants
+	bool get_push_constant_range(VkPushConstantRange& range) const {
+		if (_pushConstantSize == 0) {
+			return false;
+		}
+		range.offset = 0;
+		range.size = _pushConstantSize;
+		range.stageFlags = _pushConstantStages;
+		return true;
+	}
+
+	VkShaderStageFlags get_stages() const {
+		return _stages;
+	}
+
+	//true if both declare exactly the same bindings and push constants, so a pipeline layout made for one fits the other
+	bool same_interface(const ShaderReflection& other) const {
+		if (_bindings.size() != other._bindings.size() || _pushConstantSize != other._pushConstantSize || _pushConstantStages != other._pushConstantStages) {
+			return false;
+		}
+		for (size_t i = 0; i < _bindings.size(); i++) {
+			const Binding& a = _bindings[i];
+			const Binding& b = other._bindings[i];
+			if (a.set != b.set || a.binding != b.binding || a.type != b.type || a.count != b.count || a.stages != b.stages) {
+				return false;
+			}
+		}
+		return true;
+	}
+private:
+	static constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+	static constexpr uint32_t UNDECORATED = 0xffffffff;
+	static constexpr int MAX_TYPE_DEPTH = 16;	//valid spirv can't nest types in a cycle, this only stops a corrupt file from doing it
+
+	//the handful of opcodes, decorations and enums from the spirv spec the reflection cares about
+	enum : uint32_t {
+		OpEntryPoint = 15,
+		OpTypeInt = 21,
+		OpTypeFloat = 22,
+		OpTypeVector = 23,
+		OpTypeMatrix = 24,
+		OpTypeImage = 25,
+		OpTypeSampler = 26,
+		OpTypeSampledImage = 27,
+		OpTypeArray = 28,
+		OpTypeRuntimeArray = 29,
+		OpTypeStruct = 30,
+		OpTypePointer = 32,
+		OpConstant = 43,
+		OpVariable = 59,
+		OpDecorate = 71,
+		OpMemberDecorate = 72,
+
+		DecorationBlock = 2,
+		DecorationBufferBlock = 3,
+		DecorationArrayStride = 6,
+		DecorationMatrixStride = 7,
+		DecorationBinding = 33,
+		DecorationDescriptorSet = 34,
+		DecorationOffset = 35,
+
+		StorageClassUniformConstant = 0,
+		StorageClassUniform = 2,
+		StorageClassPushConstant = 9,
+		StorageClassStorageBuffer = 12,
+
+		DimBuffer = 5,
+		DimSubpassData = 6
+	};
+
+	struct IdInfo {
+		uint32_t	opcode = 0;			//instruction that defined the id
+		uint32_t	typeId = 0;			//pointee, element, component or column type, or the type of a variable
+		uint32_t	value = 0;			//constant value, scalar width, vector or matrix size
+		uint32_t	lengthId = 0;		//array length constant
+		uint32_t	storageClass = 0;
+		uint32_t	set = UNDECORATED;
+		uint32_t	binding = UNDECORATED;
+		uint32_t	arrayStride = 0;
+		uint32_t	dim = 0;			//image dimension and whether it's sampled (1) or storage (2)
+		uint32_t	sampled = 0;
+		bool		block = false;
+		bool		bufferBlock = false;
+		std::vector<uint32_t>	members;
+		std::vector<uint32_t>	memberOffsets;
+		std::vector<uint32_t>	memberMatrixStrides;
+	};
+
+	static bool read_definition(uint32_t opcode, const uint32_t* ins, uint32_t length, std::vector<IdInfo>& ids) {
+		//OpConstant and OpVariable put their result type first, every type instruction starts with its result
+		uint32_t resultWord = (opcode == OpConstant || opcode == OpVariable) ? 2 : 1;
+		if (length < min_length(opcode) || ins[resultWord] >= ids.size()) {
+			return false;
+		}
+		IdInfo& info = ids[ins[resultWord]];
+		info.opcode = opcode;
+
+		switch (opcode) {
+		case OpTypeInt:
+		case OpTypeFloat:
+			info.value = ins[2];
+			break;
+		case OpTypeVector:
+		case OpTypeMatrix:
+			info.typeId = ins[2];
+			info.value = ins[3];
+			break;
+		case OpTypeImage:
+			info.dim = ins[3];
+			info.sampled = ins[7];
+			break;
+		case OpTypeSampledImage:
+		case OpTypeRuntimeArray:
+			info.typeId = ins[2];
+			break;
+		case OpTypeArray:
+			info.typeId = ins[2];
+			info.lengthId = ins[3];
+			break;
+		case OpTypeStruct:
+			info.members.assign(ins + 2, ins + length);
+			break;
+		case OpTypePointer:
+			info.storageClass = ins[2];
+			info.typeId = ins[3];
+			break;
+		case OpConstant:
+			info.typeId = ins[1];
+			info.value = ins[3];	//only 32 bit constants are used as array lengths
+			break;
+		case OpVariable:
+			info.typeId = ins[1];
+			info.storageClass = ins[3];
+			break;
+		}
+
+		//every id a definition refers to has to be in range, so the lookups after the parse don't need checks
+		for (uint32_t ref : { info.typeId, info.lengthId }) {
+			if (ref >= ids.size()) {
+				return false;
+			}
+		}
+		for (uint32_t member : info.members) {
+			if (member >= ids.size()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//shortest valid encoding of each definition read_definition handles, counting the opcode word
+	static uint32_t min_length(uint32_t opcode) {
+		switch (opcode) {
+		case OpTypeSampler:
+		case OpTypeStruct:
+			return 2;
+		case OpTypeFloat:
+		case OpTypeSampledImage:
+		case OpTypeRuntimeArray:
+			return 3;
+		case OpTypeImage:
+			return 9;
+		default:
+			return 4;
+		}
+	}
+
+	//size in bytes of a type as laid out by its offset and stride decorations.
+	//matrixStride comes from the struct member the matrix sits in, 0 when there is none
+	static uint32_t type_size(const std::vector<IdInfo>& ids, uint32_t typeId, uint32_t matrixStride, int depth) {
+		if (depth >= MAX_TYPE_DEPTH) {
+			return 0;
+		}
+		const IdInfo& type = ids[typeId];
+		switch (type.opcode) {
+		case OpTypeInt:
+		case OpTypeFloat:
+			return type.value / 8;
+		case OpTypeVector:
+			return type.value * type_size(ids, type.typeId, 0, depth + 1);
+		case OpTypeMatrix:
+			return type.value * (matrixStride ? matrixStride : type_size(ids, type.typeId, 0, depth + 1));
+		case OpTypeArray: {
+			uint32_t length = ids[type.lengthId].value;
+			return length * (type.arrayStride ? type.arrayStride : type_size(ids, type.typeId, matrixStride, depth + 1));
+		}
+		case OpTypeStruct: {
+			uint32_t size = 0;
+			for (size_t i = 0; i < type.members.size(); i++) {
+				uint32_t offset = i < type.memberOffsets.size() ? type.memberOffsets[i] : 0;
+				uint32_t stride = i < type.memberMatrixStrides.size() ? type.memberMatrixStrides[i] : 0;
+				size = std::max(size, offset + type_size(ids, type.members[i], stride, depth + 1));
+			}
+			return size;
+		}
+		default:
+			return 0;	//runtime arrays have no fixed size
+		}
+	}
+
+	static bool descriptor_type(const std::vector<IdInfo>& ids, uint32_t typeId, uint32_t storageClass, VkDescriptorType& type) {
+		const IdInfo& info = ids[typeId];
+		switch (info.opcode) {
+		case OpTypeStruct:
+			//glsl "buffer" blocks are BufferBlock in the Uniform storage class before spirv 1.3, StorageBuffer after
+			type = (storageClass == StorageClassStorageBuffer || info.bufferBlock) ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			return true;
+		case OpTypeSampler:
+			type = VK_DESCRIPTOR_TYPE_SAMPLER;
+			return true;
+		case OpTypeSampledImage:
+			type = ids[info.typeId].dim == DimBuffer ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			return true;
+		case OpTypeImage:
+			if (info.dim == DimSubpassData) {
+				type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			}
+			else if (info.dim == DimBuffer) {
+				type = info.sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			}
+			else {
+				type = info.sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			}
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	static VkShaderStageFlags stage_from_execution_model(uint32_t model) {
+		switch (model) {
+		case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+		case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+		case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+		case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+		case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+		case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+		default: return 0;
+		}
+	}
+
+	//merges one binding into the sorted list, two stages declaring the same slot differently is a shader bug worth reporting
+	bool add_binding(const Binding& binding) {
+		auto it = std::lower_bound(_bindings.begin(), _bindings.end(), binding, [](const Binding& a, const Binding& b) {
+			return a.set < b.set || (a.set == b.set && a.binding < b.binding);
+			});
+		if (it != _bindings.end() && it->set == binding.set && it->binding == binding.binding) {
+			if (it->type != binding.type || it->count != binding.count) {
+				std::cout << "Shader stages disagree about set " << binding.set << " binding " << binding.binding << std::endl;
+				return false;
+			}
+			it->stages |= binding.stages;
+			return true;
+		}
+		_bindings.insert(it, binding);
+		return true;
+	}
+
+	std::vector<Binding>	_bindings;	//sorted by set, then binding
+	uint32_t				_pushConstantSize = 0;
+	VkShaderStageFlags		_pushConstantStages = 0;
+	VkShaderStageFlags		_stages = 0;
+};
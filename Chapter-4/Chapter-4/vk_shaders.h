@@ -0,0 +1,202 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include "vk_types.h"
+#include "vk_file.h"
+#include "vk_reflection.h"
+#include <string>
+#include <unordered_map>
+
+//Shader modules shared across pipelines.
+//.spv files are memory mapped rather than copied into a vector, and each one is hashed by content. Modules are keyed by that hash
+//and the word count, so two paths with the same bytes share a module, and they're reference counted: pipelines acquire() their stages before a build
+//and release() them after, and the last release destroys the module since a created pipeline no longer needs it.
+//The path, hash and reflection of every file seen are kept, that part is cheap and layouts are made from it.
+class ShaderCache {
+public:
+	//what the engine knows about a .spv file, as of the last time it was read
+	struct ShaderInfo {
+		uint64_t			hash = 0;
+		uint32_t			wordCount = 0;
+		ShaderReflection	reflection;
+	};
+
+	//a module handed out by acquire(). hash is the content it was made from, which is what pipeline keys should use
+	struct Module {
+		VkShaderModule	module = VK_NULL_HANDLE;
+		uint64_t		hash = 0;
+		uint32_t		wordCount = 0;
+	};
+
+	struct Stats {
+		uint32_t	filesRead;		//mapped and hashed
+		uint32_t	modulesCreated;
+		uint32_t	modulesShared;	//acquires answered by a module that was already alive
+	};
+
+	void init(VkDevice device) {
+		_device = device;
+	}
+
+	//destroys any module still referenced, by now that's only ones a caller forgot to release
+	void cleanup() {
+		for (auto& entry : _modules) {
+			vkDestroyShaderModule(_device, entry.second.module, nullptr);
+		}
+		_modules.clear();
+		_files.clear();
+	}
+
+	//maps the file, checks it's spirv and reflects it. Doesn't touch the cache, so the caller can compare before committing to it
+	bool read_info(const std::string& path, ShaderInfo& info) {
+		MappedFile file;
+		const uint32_t* code;
+		size_t wordCount;
+		if (!map_spirv(path, file, code, wordCount)) {
+			return false;
+		}
+		info.hash = hash_words(code, wordCount);
+		info.wordCount = (uint32_t)wordCount;
+		info.reflection = ShaderReflection{};
+		if (!info.reflection.reflect(code, wordCount)) {
+			std::cout << "Failed to reflect " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	//info for a path, read the first time it's asked for. nullptr if the file can't be read
+	const ShaderInfo* get_info(const std::string& path) {
+		auto it = _files.find(path);
+		if (it != _files.end()) {
+			return &it->second;
+		}
+		ShaderInfo info;
+		if (!read_info(path, info)) {
+			return nullptr;
+		}
+		return &(_files[path] = info);
+	}
+
+	//replaces the stored info of a path, used when a reload has been accepted
+	void set_info(const std::string& path, const ShaderInfo& info) {
+		_files[path] = info;
+	}
+
+	//a module for the file as it is on disk right now. Release it once the pipelines using it are created
+	Module acquire(const std::string& path) {
+		//a live module is reused without touching the file, as long as nothing has changed the path's content since it was read
+		const ShaderInfo* info = get_info(path);
+		if (info == nullptr) {
+			return Module{};
+		}
+		auto it = _modules.find(ModuleKey{ info->hash, info->wordCount });
+		if (it != _modules.end()) {
+			it->second.refCount++;
+			_stats.modulesShared++;
+			return Module{ it->second.module, info->hash, info->wordCount };
+		}
+
+		MappedFile file;
+		const uint32_t* code;
+		size_t wordCount;
+		if (!map_spirv(path, file, code, wordCount)) {
+			return Module{};
+		}
+
+		//the file can have changed since its info was read, the module is keyed by what was actually loaded
+		ModuleKey key{ hash_words(code, wordCount), (uint32_t)wordCount };
+		it = _modules.find(key);
+		if (it != _modules.end()) {
+			it->second.refCount++;
+			_stats.modulesShared++;
+			return Module{ it->second.module, key.hash, key.wordCount };
+		}
+
+		//the mapping is page aligned, so vulkan can read the words straight out of it
+		VkShaderModuleCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = wordCount * sizeof(uint32_t);
+		createInfo.pCode = code;
+
+		VkShaderModule module;
+		if (vkCreateShaderModule(_device, &createInfo, nullptr, &module) != VK_SUCCESS) {
+			std::cout << "Error when building the shader module " << path << std::endl;
+			return Module{};
+		}
+		_modules[key] = ModuleEntry{ module, 1 };
+		_stats.modulesCreated++;
+		return Module{ module, key.hash, key.wordCount };
+	}
+
+	void release(const Module& module) {
+		auto it = _modules.find(ModuleKey{ module.hash, module.wordCount });
+		if (it == _modules.end() || it->second.module != module.module) {
+			return;
+		}
+		if (--it->second.refCount == 0) {
+			vkDestroyShaderModule(_device, it->second.module, nullptr);
+			_modules.erase(it);
+		}
+	}
+
+	Stats get_stats() const {
+		return _stats;
+	}
+
+	size_t module_count() const {
+		return _modules.size();
+	}
+private:
+	//a 64 bit hash alone could let two different shaders share a module, files of different lengths never do
+	struct ModuleKey {
+		uint64_t	hash;
+		uint32_t	wordCount;
+
+		bool operator==(const ModuleKey& other) const {
+			return hash == other.hash && wordCount == other.wordCount;
+		}
+	};
+
+	struct ModuleKeyHash {
+		size_t operator()(const ModuleKey& key) const {
+			return (size_t)(key.hash ^ ((uint64_t)key.wordCount * 0x9e3779b97f4a7c15ull));
+		}
+	};
+
+	struct ModuleEntry {
+		VkShaderModule	module;
+		uint32_t		refCount;
+	};
+
+	static constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+	//a hot reload can catch a file the compiler is still writing, only hand out something that looks like spirv
+	bool map_spirv(const std::string& path, MappedFile& file, const uint32_t*& code, size_t& wordCount) {
+		if (!file.open(path.c_str())) {
+			return false;
+		}
+		code = (const uint32_t*)file.data();
+		wordCount = file.size() / sizeof(uint32_t);
+		if (file.size() % sizeof(uint32_t) != 0 || wordCount < 5 || code[0] != SPIRV_MAGIC) {
+			std::cout << path << " is not a valid spirv file" << std::endl;
+			return false;
+		}
+		_stats.filesRead++;
+		return true;
+	}
+
+	//FNV-1a over the words
+	static uint64_t hash_words(const uint32_t* code, size_t wordCount) {
+		uint64_t h = 14695981039346656037ull;
+		for (size_t i = 0; i < wordCount; i++) {
+			h ^= code[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	VkDevice	_device = VK_NULL_HANDLE;
+	std::unordered_map<std::string, ShaderInfo>		_files;		//by path
+	std::unordered_map<ModuleKey, ModuleEntry, ModuleKeyHash>	_modules;	//by content hash and size
+	Stats		_stats = {};
+};
@@ -0,0 +1,275 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <glm/glm.hpp>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+//Index-only mesh simplification with quadric error metrics (Garland and Heckbert 1997).
+//Edges are collapsed onto one of their existing endpoints, so a simplified index list still points into the original vertices
+//and every level of detail shares the mesh's vertex buffer.
+//Vertices on open borders, and ones sharing a position with a vertex that has other attributes (normal or color seams), never move,
+//which keeps holes from opening up. They can still be collapsed onto.
+
+//symmetric 4x4 matrix summing squared distances to planes, plus the total area of those planes
+struct Quadric {
+	double	a00, a01, a02, a03;
+	double	a11, a12, a13;
+	double	a22, a23;
+	double	a33;
+	double	weight;
+};
+
+inline Quadric make_plane_quadric(const glm::vec3& n, float d, float weight) {
+	Quadric q;
+	q.a00 = (double)n.x * n.x * weight; q.a01 = (double)n.x * n.y * weight; q.a02 = (double)n.x * n.z * weight; q.a03 = (double)n.x * d * weight;
+	q.a11 = (double)n.y * n.y * weight; q.a12 = (double)n.y * n.z * weight; q.a13 = (double)n.y * d * weight;
+	q.a22 = (double)n.z * n.z * weight; q.a23 = (double)n.z * d * weight;
+	q.a33 = (double)d * d * weight;
+	q.weight = weight;
+	return q;
+}
+
+inline void add_quadric(Quadric& q, const Quadric& r) {
+	q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02; q.a03 += r.a03;
+	q.a11 += r.a11; q.a12 += r.a12; q.a13 += r.a13;
+	q.a22 += r.a22; q.a23 += r.a23;
+	q.a33 += r.a33;
+	q.weight += r.weight;
+}
+
+//area weighted mean squared distance from p to the quadric's planes
+inline float evaluate_quadric(const Quadric& q, const glm::vec3& p) {
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z + 2.0 * q.a03 * x
+		+ q.a11 * y * y + 2.0 * q.a12 * y * z + 2.0 * q.a13 * y
+		+ q.a22 * z * z + 2.0 * q.a23 * z
+		+ q.a33;
+	return q.weight > 0.0 ? (float)(fabs(e) / q.weight) : 0.0f;
+}
+
+//simplifies the triangle list toward targetIndexCount, without any collapse moving the surface further than targetError.
+//both errors are relative to the size of the mesh (the largest side of its bounding box). resultError gets the largest error reached
+inline std::vector<uint32_t> simplify_mesh(const uint32_t* indices, size_t indexCount, const std::vector<glm::vec3>& positions, size_t targetIndexCount, float targetError, float* resultError = nullptr) {
+	std::vector<uint32_t> result(indices, indices + indexCount);
+	if (resultError) {
+		*resultError = 0.0f;
+	}
+	const size_t vertexCount = positions.size();
+	if (indexCount < 3 || vertexCount == 0) {
+		return result;
+	}
+
+	//work in a unit sized space so errors mean the same for every mesh
+	glm::vec3 minPos = positions[0];
+	glm::vec3 maxPos = positions[0];
+	for (const glm::vec3& p : positions) {
+		minPos = glm::min(minPos, p);
+		maxPos = glm::max(maxPos, p);
+	}
+	glm::vec3 size = maxPos - minPos;
+	float scale = glm::max(size.x, glm::max(size.y, size.z));
+	if (scale <= 0.0f) {
+		return result;
+	}
+	std::vector<glm::vec3> points(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		points[v] = (positions[v] - minPos) / scale;
+	}
+
+	//vertices at the same position share one quadric and one id for border and seam detection
+	struct PositionHash {
+		size_t operator()(const glm::vec3& p) const {
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+		}
+	};
+	std::unordered_map<glm::vec3, uint32_t, PositionHash> positionIds;
+	std::vector<uint32_t> canonical(vertexCount);
+	std::vector<uint32_t> sharedCount;
+	for (size_t v = 0; v < vertexCount; v++) {
+		auto it = positionIds.find(positions[v]);
+		if (it == positionIds.end()) {
+			it = positionIds.emplace(positions[v], (uint32_t)sharedCount.size()).first;
+			sharedCount.push_back(0);
+		}
+		canonical[v] = it->second;
+		sharedCount[it->second]++;
+	}
+	const size_t positionCount = sharedCount.size();
+
+	std::vector<uint8_t> locked(positionCount, 0);
+	for (size_t p = 0; p < positionCount; p++) {
+		locked[p] = sharedCount[p] > 1;
+	}
+
+	//an edge between positions used by a single triangle is on a border. Counted with both directions folded together
+	{
+		std::unordered_map<uint64_t, uint32_t> edgeUse;
+		for (size_t i = 0; i + 2 < indexCount; i += 3) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t a = canonical[indices[i + k]];
+				uint32_t b = canonical[indices[i + (k + 1) % 3]];
+				uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+				edgeUse[key]++;
+			}
+		}
+		for (auto& edge : edgeUse) {
+			if (edge.second == 1) {
+				locked[edge.first >> 32] = 1;
+				locked[edge.first & 0xffffffff] = 1;
+			}
+		}
+	}
+
+	std::vector<Quadric> quadrics(positionCount);
+	memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		const glm::vec3& p0 = points[indices[i + 0]];
+		const glm::vec3& p1 = points[indices[i + 1]];
+		const glm::vec3& p2 = points[indices[i + 2]];
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(n);
+		if (area == 0.0f) {
+			continue;
+		}
+		n /= area;
+		Quadric q = make_plane_quadric(n, -glm::dot(n, p0), area * 0.5f);
+		for (int k = 0; k < 3; k++) {
+			add_quadric(quadrics[canonical[indices[i + k]]], q);
+		}
+	}
+
+	struct Collapse {
+		uint32_t	from;
+		uint32_t	to;
+		float		cost;
+	};
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint8_t> touched(vertexCount);
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+	std::vector<uint32_t> vertexTriangles;
+	const float maxCost = targetError * targetError;
+	float maxError = 0.0f;
+
+	//each pass collapses as many edges as it can without two collapses touching the same triangles, cheapest first
+	while (result.size() > targetIndexCount) {
+		const size_t triangleCount = result.size() / 3;
+
+		//both directions of every edge, a collapse moves 'from' onto 'to' so 'from' can't be locked
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t a = result[i + k];
+				uint32_t b = result[i + (k + 1) % 3];
+				Quadric q = quadrics[canonical[a]];
+				add_quadric(q, quadrics[canonical[b]]);
+				if (!locked[canonical[a]]) {
+					collapses.push_back(Collapse{ a, b, evaluate_quadric(q, points[b]) });
+				}
+				if (!locked[canonical[b]]) {
+					collapses.push_back(Collapse{ b, a, evaluate_quadric(q, points[a]) });
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+			return a.cost < b.cost;
+			});
+
+		//triangles around every vertex, for the flip test
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (uint32_t v : result) {
+			triangleOffsets[v + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		}
+		vertexTriangles.resize(result.size());
+		{
+			std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++) {
+				vertexTriangles[fill[result[i]]++] = (uint32_t)(i / 3);
+			}
+		}
+
+		for (size_t v = 0; v < vertexCount; v++) {
+			remap[v] = (uint32_t)v;
+		}
+		std::fill(touched.begin(), touched.end(), 0);
+
+		size_t removed = 0;
+		size_t applied = 0;
+		const size_t targetRemoved = triangleCount - targetIndexCount / 3;
+		for (const Collapse& c : collapses) {
+			if (c.cost > maxCost || removed >= targetRemoved) {
+				break;
+			}
+			if (touched[c.from] || touched[c.to]) {
+				continue;
+			}
+
+			//moving 'from' onto 'to' must not turn any of the triangles that stay around inside out
+			bool flips = false;
+			size_t collapsing = 0;
+			for (uint32_t a = triangleOffsets[c.from]; a < triangleOffsets[c.from + 1] && !flips; a++) {
+				const uint32_t* tri = &result[vertexTriangles[a] * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+					collapsing++;
+					continue;
+				}
+				glm::vec3 p[3];
+				glm::vec3 moved[3];
+				for (int k = 0; k < 3; k++) {
+					p[k] = points[tri[k]];
+					moved[k] = tri[k] == c.from ? points[c.to] : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+				flips = glm::dot(before, after) <= 0.0f;
+			}
+			if (flips || collapsing == 0) {
+				continue;
+			}
+
+			remap[c.from] = c.to;
+			add_quadric(quadrics[canonical[c.to]], quadrics[canonical[c.from]]);
+			maxError = glm::max(maxError, c.cost);
+			removed += collapsing;
+			applied++;
+
+			//everything in the one ring is changed by this collapse, so it sits out the rest of the pass
+			for (uint32_t a = triangleOffsets[c.from]; a < triangleOffsets[c.from + 1]; a++) {
+				const uint32_t* tri = &result[vertexTriangles[a] * 3];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+		}
+		if (applied == 0) {
+			break;
+		}
+
+		//drop the triangles that collapsed, including ones left with two corners at the same position across a seam
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			uint32_t a = remap[result[i + 0]];
+			uint32_t b = remap[result[i + 1]];
+			uint32_t c = remap[result[i + 2]];
+			if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[a] == canonical[c]) {
+				continue;
+			}
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	if (resultError) {
+		*resultError = sqrtf(maxError);
+	}
+	return result;
+}
@@ -0,0 +1,69 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+//one entry of the draw sort, index points back at the object the key was built for
+struct SortItem {
+	uint64_t	key;
+	uint32_t	index;
+};
+
+//builds a draw sort key, most significant field first so sorting groups pipelines, then descriptor state, then meshes.
+//depth is a 0..65535 bucket, nearest first, which keeps each mesh's instances roughly front to back
+inline uint64_t make_sort_key(uint32_t pipelineId, uint32_t materialId, uint32_t meshId, uint32_t depthBucket) {
+	return ((uint64_t)(pipelineId & 0xffff) << 48) | ((uint64_t)(materialId & 0xffff) << 32) | ((uint64_t)(meshId & 0xffff) << 16) | (uint64_t)(depthBucket & 0xffff);
+}
+
+//stable LSD radix sort on the 64 bit keys, 8 bits per pass.
+//passes where every key has the same byte are skipped, which is most of them when there are only a few pipelines and meshes
+inline void radix_sort(std::vector<SortItem>& items, std::vector<SortItem>& scratch) {
+	const size_t count = items.size();
+	if (count < 2) {
+		return;
+	}
+	scratch.resize(count);
+
+	//all eight histograms in one read over the keys
+	uint32_t histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (size_t i = 0; i < count; i++) {
+		uint64_t key = items[i].key;
+		for (int pass = 0; pass < 8; pass++) {
+			histograms[pass][(key >> (pass * 8)) & 0xff]++;
+		}
+	}
+
+	SortItem* src = items.data();
+	SortItem* dst = scratch.data();
+	for (int pass = 0; pass < 8; pass++) {
+		uint32_t* histogram = histograms[pass];
+		const int shift = pass * 8;
+
+		if (histogram[(src[0].key >> shift) & 0xff] == count) {
+			continue;
+		}
+
+		//histogram to starting offsets
+		uint32_t offset = 0;
+		for (int b = 0; b < 256; b++) {
+			uint32_t n = histogram[b];
+			histogram[b] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+
+		SortItem* tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	//an odd number of passes leaves the result in the scratch buffer
+	if (src != items.data()) {
+		items.swap(scratch);
+	}
+}
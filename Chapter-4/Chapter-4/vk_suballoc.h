@@ -0,0 +1,101 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include <map>
+#include <iterator>
+#include <cstdint>
+
+//Hands out ranges of a fixed size buffer, measured in whatever unit the caller uses (vertices, indices, bytes).
+//Free space is a list of blocks ordered by offset. Allocation takes the first block that fits,
+//freeing merges the range with the free blocks on either side so space doesn't fragment into slivers.
+class RangeAllocator {
+public:
+	struct Stats {
+		uint32_t	used;
+		uint32_t	capacity;
+		uint32_t	freeBlocks;
+		uint32_t	largestFreeBlock;
+	};
+
+	void init(uint32_t capacity) {
+		_capacity = capacity;
+		_used = 0;
+		_freeBlocks.clear();
+		if (capacity > 0) {
+			_freeBlocks[0] = capacity;
+		}
+	}
+
+	//false if no free block is big enough, the buffer is full or too fragmented.
+	//offset comes back a multiple of alignment, which doesn't need to be a power of two (vertex strides aren't)
+	bool allocate(uint32_t size, uint32_t& offset, uint32_t alignment = 1) {
+		if (size == 0) {
+			offset = 0;
+			return true;
+		}
+		for (auto it = _freeBlocks.begin(); it != _freeBlocks.end(); ++it) {
+			uint32_t blockOffset = it->first;
+			uint32_t blockSize = it->second;
+			uint32_t padding = (alignment - blockOffset % alignment) % alignment;
+			if (blockSize < padding || blockSize - padding < size) {
+				continue;
+			}
+			offset = blockOffset + padding;
+			uint32_t remaining = blockSize - padding - size;
+			//the padding in front stays a free block of its own
+			if (padding > 0) {
+				it->second = padding;
+			}
+			else {
+				_freeBlocks.erase(it);
+			}
+			if (remaining > 0) {
+				_freeBlocks[offset + size] = remaining;
+			}
+			_used += size;
+			return true;
+		}
+		return false;
+	}
+
+	//size has to be the size the range was allocated with
+	void free(uint32_t offset, uint32_t size) {
+		if (size == 0) {
+			return;
+		}
+		_used -= size;
+
+		auto next = _freeBlocks.lower_bound(offset);
+		//merge with the block right after
+		if (next != _freeBlocks.end() && offset + size == next->first) {
+			size += next->second;
+			next = _freeBlocks.erase(next);
+		}
+		//and with the block right before
+		if (next != _freeBlocks.begin()) {
+			auto prev = std::prev(next);
+			if (prev->first + prev->second == offset) {
+				prev->second += size;
+				return;
+			}
+		}
+		_freeBlocks[offset] = size;
+	}
+
+	Stats get_stats() const {
+		Stats stats;
+		stats.used = _used;
+		stats.capacity = _capacity;
+		stats.freeBlocks = (uint32_t)_freeBlocks.size();
+		stats.largestFreeBlock = 0;
+		for (auto& block : _freeBlocks) {
+			if (block.second > stats.largestFreeBlock) {
+				stats.largestFreeBlock = block.second;
+			}
+		}
+		return stats;
+	}
+private:
+	std::map<uint32_t, uint32_t>	_freeBlocks;	//offset -> size
+	uint32_t	_capacity = 0;
+	uint32_t	_used = 0;
+};
@@ -0,0 +1,304 @@
+#pragma once
+//based on https://vkguide.dev/ by Victor Blanco
+#include "vk_types.h"
+#include <cstring>
+
+//Streams buffer and image data to the gpu without blocking the frame.
+//Copies are recorded on the dedicated transfer queue when the device has one, otherwise on the graphics queue.
+//When the queues are from different families the copy ends with a queue family ownership release,
+//and poll() records the matching acquire into the graphics command buffer once the copy's fence has signaled.
+class AsyncUploader {
+	struct PendingBatch {
+		VkCommandBuffer						cmd = VK_NULL_HANDLE;
+		VkFence								fence = VK_NULL_HANDLE;
+		std::vector<AllocatedBuffer>		stagingBuffers;
+		std::vector<VkBufferMemoryBarrier>	bufferAcquires;
+		std::vector<VkImageMemoryBarrier>	imageAcquires;
+		VkPipelineStageFlags				dstStages = 0;
+		std::function<void()>				onComplete;
+	};
+
+	VkDevice				_device = VK_NULL_HANDLE;
+	VmaAllocator			_allocator = nullptr;
+	VkQueue					_queue = VK_NULL_HANDLE;
+	uint32_t				_queueFamily = 0;
+	uint32_t				_graphicsQueueFamily = 0;
+	VkCommandPool			_commandPool = VK_NULL_HANDLE;
+
+	PendingBatch				_recording;
+	bool						_isRecording = false;
+	std::vector<PendingBatch>	_inFlight;
+
+	//recycled so steady streaming doesn't create and destroy vulkan objects every batch
+	std::vector<VkCommandBuffer>	_freeCommandBuffers;
+	std::vector<VkFence>			_freeFences;
+
+	bool has_ownership_transfer() const {
+		return _queueFamily != _graphicsQueueFamily;
+	}
+
+	void begin_recording() {
+		if (_isRecording) {
+			return;
+		}
+		if (_freeCommandBuffers.empty()) {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = _commandPool;
+			allocInfo.commandBufferCount = 1;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			VkCommandBuffer cmd;
+			VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &cmd));
+			_freeCommandBuffers.push_back(cmd);
+		}
+		_recording = PendingBatch{};
+		_recording.cmd = _freeCommandBuffers.back();
+		_freeCommandBuffers.pop_back();
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK(vkBeginCommandBuffer(_recording.cmd, &beginInfo));
+		_isRecording = true;
+	}
+
+	AllocatedBuffer create_staging(const void* data, size_t size) {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		VmaAllocationCreateInfo vmaAllocInfo{};
+		vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+		AllocatedBuffer staging;
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaAllocInfo, &staging._buffer, &staging._allocation, nullptr));
+
+		void* mapped;
+		vmaMapMemory(_allocator, staging._allocation, &mapped);
+		memcpy(mapped, data, size);
+		vmaUnmapMemory(_allocator, staging._allocation);
+		return staging;
+	}
+
+	void retire(PendingBatch& batch) {
+		for (auto& staging : batch.stagingBuffers) {
+			vmaDestroyBuffer(_allocator, staging._buffer, staging._allocation);
+		}
+		vkResetFences(_device, 1, &batch.fence);
+		vkResetCommandBuffer(batch.cmd, 0);
+		_freeFences.push_back(batch.fence);
+		_freeCommandBuffers.push_back(batch.cmd);
+	}
+public:
+	void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, uint32_t graphicsQueueFamily) {
+		_device = device;
+		_allocator = allocator;
+		_queue = queue;
+		_queueFamily = queueFamily;
+		_graphicsQueueFamily = graphicsQueueFamily;
+
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = _queueFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		VK_CHECK(vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool));
+	}
+
+	void cleanup() {
+		for (auto& batch : _inFlight) {
+			vkWaitForFences(_device, 1, &batch.fence, true, UINT64_MAX);
+			retire(batch);
+		}
+		_inFlight.clear();
+		if (_isRecording) {
+			vkEndCommandBuffer(_recording.cmd);
+			for (auto& staging : _recording.stagingBuffers) {
+				vmaDestroyBuffer(_allocator, staging._buffer, staging._allocation);
+			}
+			_isRecording = false;
+		}
+		for (VkFence fence : _freeFences) {
+			vkDestroyFence(_device, fence, nullptr);
+		}
+		_freeFences.clear();
+		_freeCommandBuffers.clear();
+		vkDestroyCommandPool(_device, _commandPool, nullptr);
+	}
+
+	bool uses_dedicated_queue() const {
+		return has_ownership_transfer();
+	}
+
+	size_t batches_in_flight() const {
+		return _inFlight.size();
+	}
+
+	//stages data and records a copy into dst. dstStage/dstAccess describe how the graphics queue will use the buffer.
+	void upload_buffer(const void* data, size_t size, VkBuffer dst, VkDeviceSize dstOffset, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+		//zero sized buffers and copies are invalid, there's nothing to send anyway
+		if (size == 0) {
+			return;
+		}
+		begin_recording();
+
+		AllocatedBuffer staging = create_staging(data, size);
+		_recording.stagingBuffers.push_back(staging);
+
+		VkBufferCopy copy{};
+		copy.srcOffset = 0;
+		copy.dstOffset = dstOffset;
+		copy.size = size;
+		vkCmdCopyBuffer(_recording.cmd, staging._buffer, dst, 1, &copy);
+
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.buffer = dst;
+		barrier.offset = dstOffset;
+		barrier.size = size;
+		barrier.srcQueueFamilyIndex = has_ownership_transfer() ? _queueFamily : VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = has_ownership_transfer() ? _graphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+
+		if (has_ownership_transfer()) {
+			//release half of the ownership transfer, the destination access mask is ignored here
+			VkBufferMemoryBarrier release = barrier;
+			release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			release.dstAccessMask = 0;
+			vkCmdPipelineBarrier(_recording.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+
+			//acquire half, the source access mask is ignored here
+			barrier.srcAccessMask = 0;
+		}
+		else {
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		}
+		barrier.dstAccessMask = dstAccess;
+		_recording.bufferAcquires.push_back(barrier);
+		_recording.dstStages |= dstStage;
+	}
+
+	//stages pixel data and copies it into mip 0 of a 2d image, leaving the image in finalLayout on the graphics queue
+	void upload_image(const void* data, size_t size, VkImage image, VkExtent3D extent, VkImageAspectFlags aspect, VkImageLayout finalLayout, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+		begin_recording();
+
+		AllocatedBuffer staging = create_staging(data, size);
+		_recording.stagingBuffers.push_back(staging);
+
+		VkImageSubresourceRange range{};
+		range.aspectMask = aspect;
+		range.baseMipLevel = 0;
+		range.levelCount = 1;
+		range.baseArrayLayer = 0;
+		range.layerCount = 1;
+
+		VkImageMemoryBarrier toTransfer{};
+		toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		toTransfer.image = image;
+		toTransfer.subresourceRange = range;
+		toTransfer.srcAccessMask = 0;
+		toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(_recording.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+		VkBufferImageCopy copy{};
+		copy.bufferOffset = 0;
+		copy.bufferRowLength = 0;
+		copy.bufferImageHeight = 0;
+		copy.imageSubresource.aspectMask = aspect;
+		copy.imageSubresource.mipLevel = 0;
+		copy.imageSubresource.baseArrayLayer = 0;
+		copy.imageSubresource.layerCount = 1;
+		copy.imageExtent = extent;
+		vkCmdCopyBufferToImage(_recording.cmd, staging._buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+		//the layout transition is part of the ownership transfer, so release and acquire both describe it
+		VkImageMemoryBarrier barrier = toTransfer;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = finalLayout;
+		barrier.srcQueueFamilyIndex = has_ownership_transfer() ? _queueFamily : VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = has_ownership_transfer() ? _graphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+
+		if (has_ownership_transfer()) {
+			VkImageMemoryBarrier release = barrier;
+			release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			release.dstAccessMask = 0;
+			vkCmdPipelineBarrier(_recording.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &release);
+			barrier.srcAccessMask = 0;
+		}
+		else {
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		}
+		barrier.dstAccessMask = dstAccess;
+		_recording.imageAcquires.push_back(barrier);
+		_recording.dstStages |= dstStage;
+	}
+
+	//submits everything recorded since the last submit. onComplete runs inside poll() once the data is usable by the graphics queue.
+	void submit(std::function<void()>&& onComplete) {
+		if (!_isRecording) {
+			if (onComplete) {
+				onComplete();
+			}
+			return;
+		}
+		VK_CHECK(vkEndCommandBuffer(_recording.cmd));
+
+		if (_freeFences.empty()) {
+			VkFenceCreateInfo fenceInfo{};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			VkFence fence;
+			VK_CHECK(vkCreateFence(_device, &fenceInfo, nullptr, &fence));
+			_freeFences.push_back(fence);
+		}
+		_recording.fence = _freeFences.back();
+		_freeFences.pop_back();
+		_recording.onComplete = std::move(onComplete);
+
+		VkSubmitInfo submit{};
+		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit.commandBufferCount = 1;
+		submit.pCommandBuffers = &_recording.cmd;
+		VK_CHECK(vkQueueSubmit(_queue, 1, &submit, _recording.fence));
+
+		_inFlight.push_back(std::move(_recording));
+		_isRecording = false;
+	}
+
+	//checks the in-flight copies without waiting. For every finished one, records the acquire barriers into graphicsCmd,
+	//frees its staging memory and runs its completion callback. Must be called outside of a render pass.
+	void poll(VkCommandBuffer graphicsCmd) {
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		VkPipelineStageFlags dstStages = 0;
+		std::vector<std::function<void()>> callbacks;
+
+		for (size_t i = 0; i < _inFlight.size();) {
+			PendingBatch& batch = _inFlight[i];
+			if (vkGetFenceStatus(_device, batch.fence) != VK_SUCCESS) {
+				i++;
+				continue;
+			}
+			bufferBarriers.insert(bufferBarriers.end(), batch.bufferAcquires.begin(), batch.bufferAcquires.end());
+			imageBarriers.insert(imageBarriers.end(), batch.imageAcquires.begin(), batch.imageAcquires.end());
+			dstStages |= batch.dstStages;
+			if (batch.onComplete) {
+				callbacks.push_back(std::move(batch.onComplete));
+			}
+			retire(batch);
+			_inFlight.erase(_inFlight.begin() + i);
+		}
+
+		if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+			VkPipelineStageFlags srcStage = has_ownership_transfer() ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
+			vkCmdPipelineBarrier(graphicsCmd, srcStage, dstStages, 0, 0, nullptr,
+				(uint32_t)bufferBarriers.size(), bufferBarriers.data(), (uint32_t)imageBarriers.size(), imageBarriers.data());
+		}
+
+		for (auto& callback : callbacks) {
+			callback();
+		}
+	}
+};